@@ -2,96 +2,362 @@
  *  ADKeyboard.h
  *  Peter Hinson / 2011
  *  mewp.net
- *  
+ *
  *  Code for reading an ADKeyboard analog button pad in a single wire fashion.
  *
+ *  The pad doesn't read the ADC itself: AnalogSampler hands it a sample
+ *  every millisecond or two from the ADC interrupt, and sample() turns
+ *  those into key events in a small ring. loop() only drains the ring.
+ *
+ *  Debouncing doesn't wait: a change only counts once the same key has
+ *  been read debounce_samples times in a row, spread over at least
+ *  debounce_time.
+ *
+ *  Held keys repeat faster the longer they're held, and each repeat
+ *  carries a multiplier, 1, 10, 100... for how many increments it's
+ *  worth, so the far end of a long range is a few seconds away.
+ *
+ *  Besides presses, releases and repeats it reports long presses,
+ *  double clicks and two key chords. A ladder only ever reads the
+ *  lowest key held, so the one chord it can see is a key held and then
+ *  a lower one pressed with it: the reading goes straight from one to
+ *  the other without passing through open. Only a lower key that comes
+ *  within chord_time of the first counts; later, it's taken as a roll
+ *  from one key to the next, and the first key is let go.
+ *
+ *  A press that turns out to be none of those, and didn't repeat, is
+ *  also reported as a click. Keys set to double click wait
+ *  double_click_time for a second press first, the rest click as soon
+ *  as they're let go. A key with gestures acts on its clicks, so the
+ *  start of a gesture doesn't do the plain press's job as well.
+ *
+ *  The keyboard is a template on its resistor ladder, the reading each
+ *  key gives. The thresholds between keys are worked out by the compiler,
+ *  halfway between neighbours, and a ladder that won't read reliably
+ *  (out of order, or keys too close together) doesn't compile.
+ *
  */
 
 #ifndef ADKeyboard_h
 #define ADKeyboard_h
 
 #include "WProgram.h"
+#include <avr/pgmspace.h>
+#include "Timebase.h"
+
+#define KEY_EVENTS              8                       // Ring size, must be a power of two
+#define KEY_LADDER_MAX          8                       // Most keys a ladder can have
+#define KEY_MIN_GAP             40                      // ADC counts between neighbouring keys, for noise and resistor tolerance
+#define KEY_REPEAT_STAGES       5
+
+// No static_assert before C++11: an array of size -1 fails to compile.
+#define KEY_STATIC_ASSERT(condition, name)  typedef char name[(condition) ? 1 : -1]
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * Ladders
+ * *  ---------------------------------------------------------
+ * *    A ladder gives the number of keys and the nominal reading
+ * *    of each, r0 lowest. Readings it doesn't set are left at
+ * *    open, the reading with no key down.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+struct KeyLadder
+{
+    enum { open = 1023, r0 = open, r1 = open, r2 = open, r3 = open, r4 = open, r5 = open, r6 = open, r7 = open };
+};
+
+// DFRobot's five button ADKeyboard module. What the original 50/200/400/600/800 table was for.
+struct ADKeyModule : KeyLadder
+{
+    enum { keys = 5, r0 = 0, r1 = 145, r2 = 329, r3 = 505, r4 = 741 };
+};
+
+// DFRobot LCD Keypad Shield, v1.0: right, up, down, left, select. Reset isn't on the ladder.
+struct LCDKeypadShield : KeyLadder
+{
+    enum { keys = 5, r0 = 0, r1 = 99, r2 = 255, r3 = 409, r4 = 639 };
+};
+
+enum eKeyEventType { kKeyDown, kKeyUp, kKeyRepeat, kKeyLongPress, kKeyDoubleClick, kKeyChord, kKeyClick };
+
+struct KeyEvent
+{
+    uint8_t         type;                               // eKeyEventType
+    int8_t          key;
+    int8_t          other;                              // kKeyChord, the key that was already held. -1 otherwise.
+    uint16_t        multiplier;                         // Increments a repeat is worth, 1 otherwise
+    unsigned long   time;                               // Timebase::now() when it settled
+};
+
+struct KeyRepeatStage
+{
+    uint16_t        repeats;                            // Repeats before moving to the next stage, 0 for the last
+    uint16_t        rate;                               // ms between them
+    uint16_t        multiplier;
+};
+
+// After repeat_delay: 1.5 s of single steps, then tens, hundreds, thousands, ten thousands.
+const KeyRepeatStage kRepeatStages[KEY_REPEAT_STAGES] PROGMEM = {
+    { 10, 150, 1 },
+    { 10, 100, 10 },
+    { 10, 80, 100 },
+    { 15, 60, 1000 },
+    { 0, 60, 10000 }
+};
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * * * ADKeyboard
  * *  ---------------------------------------------------------
- * *    Interface for an ADKeyboard controller.
+ * *    Interface for an ADKeyboard controller. The ring has one
+ * *    writer, sample() in the interrupt, and one reader, loop()
+ * *    through nextEvent(), so each end moves its own index and
+ * *    neither needs interrupts off. Events that find the ring
+ * *    full are counted in dropped.
  * *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+template <class Ladder>
 class ADKeyboard {
     private:
+        // Thresholds, halfway between neighbouring readings. Past the last key they're all open.
+        enum {
+            t0 = (Ladder::r0 + Ladder::r1) / 2,
+            t1 = (Ladder::r1 + Ladder::r2) / 2,
+            t2 = (Ladder::r2 + Ladder::r3) / 2,
+            t3 = (Ladder::r3 + Ladder::r4) / 2,
+            t4 = (Ladder::r4 + Ladder::r5) / 2,
+            t5 = (Ladder::r5 + Ladder::r6) / 2,
+            t6 = (Ladder::r6 + Ladder::r7) / 2,
+            t7 = (Ladder::r7 + Ladder::open) / 2
+        };
+
+        KEY_STATIC_ASSERT(Ladder::keys >= 1 && Ladder::keys <= KEY_LADDER_MAX, ladder_key_count);
+        KEY_STATIC_ASSERT(Ladder::r0 >= 0 && Ladder::open <= 1023, ladder_in_range);
+        KEY_STATIC_ASSERT(Ladder::keys < 1 || Ladder::r1 - Ladder::r0 >= KEY_MIN_GAP, ladder_gap_0);
+        KEY_STATIC_ASSERT(Ladder::keys < 2 || Ladder::r2 - Ladder::r1 >= KEY_MIN_GAP, ladder_gap_1);
+        KEY_STATIC_ASSERT(Ladder::keys < 3 || Ladder::r3 - Ladder::r2 >= KEY_MIN_GAP, ladder_gap_2);
+        KEY_STATIC_ASSERT(Ladder::keys < 4 || Ladder::r4 - Ladder::r3 >= KEY_MIN_GAP, ladder_gap_3);
+        KEY_STATIC_ASSERT(Ladder::keys < 5 || Ladder::r5 - Ladder::r4 >= KEY_MIN_GAP, ladder_gap_4);
+        KEY_STATIC_ASSERT(Ladder::keys < 6 || Ladder::r6 - Ladder::r5 >= KEY_MIN_GAP, ladder_gap_5);
+        KEY_STATIC_ASSERT(Ladder::keys < 7 || Ladder::r7 - Ladder::r6 >= KEY_MIN_GAP, ladder_gap_6);
+        KEY_STATIC_ASSERT(Ladder::keys < 8 || Ladder::open - Ladder::r7 >= KEY_MIN_GAP, ladder_gap_7);
+
         int in_pin;
-        int NUM_KEYS;
-        int adc_key_in;
-        int last_adc;
         int key;
         int oldkey;
-        int repeat_delay;
-        int repeat_rate;
+        unsigned long repeat_delay;
         unsigned long previous_time;
-        int last_read_time;
+        bool held;                                      // A repeatable key is down and previous_time is valid
+        uint8_t stage;                                  // kRepeatStages entry the held key is on
+        uint8_t repeats;                                // ...and how many repeats it's had there
+
+        unsigned long long_press_time;
+        unsigned long double_click_time;                // Most ms from a release to the same key's next press
+        unsigned long chord_time;                       // Most ms from the first key's press to the second's
+        uint8_t double_click_keys;                      // Keys that double click, a bit each
+        unsigned long pressed_time;
+        bool long_sent;                                 // Long press already reported for this press
+        bool gestured;                                  // This press repeated, or was part of a gesture, so it's no click
+        int released;                                   // Last key clicked, waiting to see if it's a double click
+        unsigned long released_time;
+        int chorded;                                    // Held first in a chord, down as far as we know
+
+        int candidate;                                  // Key that's been read, but isn't settled yet
+        uint8_t stable;                                 // Samples in a row it's been read for
+        unsigned long candidate_time;                   // When it was first read
+        uint8_t debounce_samples;
+        unsigned long debounce_time;
+
+        KeyEvent events[KEY_EVENTS];
+        volatile uint8_t head;                          // Moved on by sample() only
+        volatile uint8_t tail;                          // Moved on by nextEvent() only
+
+        void push(uint8_t type, int8_t key, unsigned long time, uint16_t multiplier = 1, int8_t other = -1)
+        {
+            if ((uint8_t)(head - tail) >= KEY_EVENTS) { dropped++; return; }
+
+            KeyEvent *event     = &events[head & (KEY_EVENTS - 1)];
+            event->type         = type;
+            event->key          = key;
+            event->other        = other;
+            event->multiplier   = multiplier;
+            event->time         = time;
+            __asm__ __volatile__ ("" ::: "memory");     // The event is written before it's published
+            head++;
+        }
+
+        //--------------------------------------
+        //  + settle
+        //  The reading has moved to a new key, or to none, and stayed.
+        void settle(unsigned long now)
+        {
+            if (oldkey >= 0 && key >= 0 && key == chorded) {    // The chord's second key let go, the first is still down
+                push(kKeyUp, oldkey, now);
+                oldkey      = key;
+                chorded     = -1;
+                held        = false;                    // No repeats or long press for what's left
+                long_sent   = true;
+                return;
+            }
+            if (oldkey >= 0 && key >= 0 && key < oldkey && chorded < 0 && now - pressed_time <= chord_time) {
+                // Straight to a lower key, soon enough that the higher one is still held
+                chorded     = oldkey;
+                oldkey      = key;
+                held        = false;
+                long_sent   = true;
+                gestured    = true;                     // Neither key of a chord clicks
+                push(kKeyChord, key, now, 1, chorded);
+                return;
+            }
+
+            if (oldkey >= 0) {
+                push(kKeyUp, oldkey, now);
+                if (chorded >= 0) push(kKeyUp, chorded, now);   // Let go unseen while the lower key was down
+                if (!gestured) {
+                    if (double_click_keys & (1 << oldkey)) {    // A click, unless it's the first of a double
+                        released        = oldkey;
+                        released_time   = now;
+                    } else push(kKeyClick, oldkey, now);        // No double to wait for
+                }
+            }
+            chorded = -1;
+            oldkey  = key;
+
+            if (key >=0) {
+                previous_time   = now;
+                pressed_time    = now;
+                held            = true;
+                long_sent       = false;
+                gestured        = false;
+                stage           = 0;
+                repeats         = 0;
+
+                if (key == released && now - released_time <= double_click_time) {
+                    push(kKeyDown, key, now);
+                    push(kKeyDoubleClick, key, now);
+                    gestured = true;                    // A third click starts over
+                } else {
+                    if (released >= 0) push(kKeyClick, released, now);  // Another key, the last one was a click
+                    push(kKeyDown, key, now);
+                }
+                released = -1;
+            } else {
+                held = false;
+            }
+        }
 
     public:
-        ADKeyboard(int pin = 0) 
+        unsigned int dropped;
+
+        ADKeyboard(int pin = 0)
         {
             in_pin                  = pin;
-            NUM_KEYS                = 5;
             key                     = -1;
             oldkey                  = -1;
-            last_adc                = 0;
             repeat_delay            = 800;
-            repeat_rate             = 150;
             previous_time           = 0;
-    /*      
-            last_check_time         = 0;                // The last time we did an analogRead
-            debounce_time           = 0;
-    */
+            held                    = false;
+            stage                   = 0;
+            repeats                 = 0;
+            long_press_time         = 1000;
+            double_click_time       = 300;
+            chord_time              = 250;
+            double_click_keys       = 0xFF;
+            pressed_time            = 0;
+            long_sent               = true;
+            gestured                = false;
+            released                = -1;
+            released_time           = 0;
+            chorded                 = -1;
+            candidate               = -1;
+            stable                  = 0;
+            candidate_time          = 0;
+            debounce_samples        = 3;
+            debounce_time           = 40;
+            head                    = 0;
+            tail                    = 0;
+            dropped                 = 0;
         }
-        
-        int readKeyboard()
-        {   
-            adc_key_in  = analogRead(in_pin);           // read the value from the sensor
-            key         = get_key(adc_key_in);          // convert into key press
-            
+
+        int pin() { return in_pin; }
+        void setDoubleClickKeys(uint8_t keys) { double_click_keys = keys; }   // A bit per key, all of them to start with
+        bool isBouncing() { return candidate != oldkey || released >= 0; }  // A change or a click is being waited out, keep sampling
+
+        // From the ADC interrupt only
+        void sample(unsigned int adc_key_in)
+        {
+            key = get_key(adc_key_in);                  // convert into key press
+            unsigned long now = Timebase::now();
+
             if (key != oldkey) // if key change is detected
             {
-                // TODO: get rid of the delays!
-                delay(50);                              // wait for debounce time
-                adc_key_in  = analogRead(in_pin);       // read the value from the sensor 
-                key         = get_key(adc_key_in);      // convert into key press
-                
-                if (key != oldkey)    
-                {
-                    oldkey = key;
-                    
-                    if (key >=0) {
-                        previous_time = millis();
-                        return key;
-                    } else {
-                        previous_time = 0;
-                    }
-                } 
-            }   // Check if this key is being held down... we don't want to repeat if it's 0 (enter) though.
-            else if (key >=1 && key < NUM_KEYS && previous_time > 0 && millis()-previous_time > repeat_delay) {
-                // Held down, past the timeout... Repeat!
-                previous_time   += repeat_rate;
-                return key;
+                if (key != candidate) {                 // Different from last time, start counting again
+                    candidate       = key;
+                    candidate_time  = now;
+                    stable          = 1;
+                    return;
+                }
+                if (stable < debounce_samples) stable++;
+                if (stable < debounce_samples || now - candidate_time < debounce_time)
+                    return;                             // Not settled yet
+
+                settle(now);
+                return;
+            }
+
+            candidate = oldkey;                         // Bounced back to where it was, forget the change
+
+            if (key < 0 && released >= 0 && now - released_time > double_click_time) {
+                push(kKeyClick, released, now);         // No second press came
+                released = -1;
+            }
+
+            if (key >= 0 && !long_sent && now - pressed_time >= long_press_time) {
+                long_sent   = true;
+                gestured    = true;
+                push(kKeyLongPress, key, now);
+            }
+
+            // Check if this key is being held down... we don't want to repeat if it's 0 (enter) though.
+            if (key >=1 && held && now - previous_time > repeat_delay) {
+                // Held down, past the timeout... Repeat! Sooner and bigger as it goes on.
+                const KeyRepeatStage *at = &kRepeatStages[stage];
+                previous_time   += pgm_read_word(&at->rate);
+                gestured        = true;
+                push(kKeyRepeat, key, now, pgm_read_word(&at->multiplier));
+
+                if (stage < KEY_REPEAT_STAGES - 1 && ++repeats >= pgm_read_word(&at->repeats)) {
+                    stage++;
+                    repeats = 0;
+                }
             }
-            return -1;  // No key change
         }
 
-        // Convert ADC value to key number
-        int get_key(unsigned int input)
-        {   // See if the input values are associated with a key
-            int adc_key_val[5]  = { 50, 200, 400, 600, 800 };
-            int k;
-            for (k = 0; k < NUM_KEYS; k++)
-                if (input < adc_key_val[k]) return k;
+        //--------------------------------------
+        //  + nextEvent
+        //  Takes the oldest event off the ring. False if there are none.
+        bool nextEvent(KeyEvent *event)
+        {
+            if (tail == head) return false;
+
+            *event = events[tail & (KEY_EVENTS - 1)];
+            __asm__ __volatile__ ("" ::: "memory");     // Copied out before the slot is handed back
+            tail++;
+            return true;
+        }
 
-            if (k >= NUM_KEYS) { previous_time = 0; k = -1; }  // No valid key pressed
-            return k;
+        //--------------------------------------
+        //  + get_key
+        //  Convert ADC value to key number, -1 for none. The key is
+        //  how many thresholds the reading is at or above: eight
+        //  compares against constants, no table and no loop.
+        static int get_key(unsigned int input)
+        {
+            int k = (input >= t0) + (input >= t1) + (input >= t2) + (input >= t3)
+                  + (input >= t4) + (input >= t5) + (input >= t6) + (input >= t7);
+            return k < Ladder::keys ? k : -1;
         }
 };
 
-#endif
\ No newline at end of file
+#endif
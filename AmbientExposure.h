@@ -0,0 +1,135 @@
+/*
+ *  AmbientExposure.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Follows the light. Exposure (or the interval) is scaled against the
+ *  light level it started at: half the light, twice the exposure. For
+ *  sunsets and sunrises where the length of the ramp isn't known ahead.
+ *
+ *	It doesn't chase every flicker. A change has to get past the
+ *	hysteresis before anything moves, then it's followed until it's
+ *	caught up, never more than max_step in one frame so the sequence
+ *	doesn't flicker either.
+ *
+ */
+
+#ifndef AmbientExposure_h
+#define AmbientExposure_h
+
+#include "WProgram.h"
+
+#define AMBIENT_ONE			65536UL		// Ratios are Q16
+#define AMBIENT_HYSTERESIS	82570UL		// 1/3 stop before following a change
+#define AMBIENT_MAX_STEP	73562UL		// 1/6 stop most per frame
+
+enum eAmbientMode { kAmbientOff, kAmbientExposure, kAmbientInterval };
+
+typedef unsigned int (*LightLevelCallback)();
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * AmbientExposure
+ * *  ---------------------------------------------------------
+ * *	Works on a plain number, exposure in us or interval in ms;
+ * *	Intervalometer decides which. Also keeps how far each frame
+ * *	was from the ideal value, uncapped and unlimited, to judge
+ * *	the tracking by.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class AmbientExposure
+{
+	public:
+		AmbientExposure();
+
+		void setLevelCallback(LightLevelCallback callback) { _level = callback; }
+		void start(eAmbientMode mode, unsigned long base);
+		void stop() { _mode = kAmbientOff; }
+		bool isActive() { return _mode != kAmbientOff; }
+		eAmbientMode getMode() { return _mode; }
+
+		unsigned long next(unsigned long floor, unsigned long ceiling);
+		unsigned long current() { return _value; }
+		unsigned long meanError() { return _frames ? _error_sum / _frames : 0; }
+
+		unsigned long	hysteresis;		// Q16 ratio, > 1
+		unsigned long	max_step;		// Q16 ratio, > 1
+		unsigned long	worst_error;	// Percent off the ideal
+		unsigned long	ideal;			// What the latest frame should have been
+
+	private:
+		eAmbientMode		_mode;
+		LightLevelCallback	_level;
+		unsigned long		_base;		// Value at the start...
+		unsigned int		_reference;	// ...and the light level it went with
+		unsigned long		_value;
+		bool				_tracking;	// Past the hysteresis and catching up
+		unsigned long		_frames;
+		unsigned long		_error_sum;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * AmbientExposure Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+AmbientExposure::AmbientExposure()
+{
+	_mode		= kAmbientOff;
+	_level		= NULL;
+	_value		= 0;
+	hysteresis	= AMBIENT_HYSTERESIS;
+	max_step	= AMBIENT_MAX_STEP;
+	worst_error	= 0;
+	ideal		= 0;
+}
+
+void AmbientExposure::start(eAmbientMode mode, unsigned long base)
+{
+	_mode		= (_level && base > 0) ? mode : kAmbientOff;
+	_base		= base;
+	_value		= base;
+	_reference	= _level ? _level() : 1;
+	if (_reference == 0) _reference = 1;
+	_tracking	= false;
+	_frames		= 0;
+	_error_sum	= 0;
+	worst_error	= 0;
+	ideal		= base;
+}
+
+//--------------------------------------
+//	+ next
+//	This frame's value, kept between floor and ceiling. Integer only:
+//	the ideal is base * reference / level, and the step is worked out
+//	as a Q16 ratio of ideal to current.
+unsigned long AmbientExposure::next(unsigned long floor, unsigned long ceiling)
+{
+	unsigned int level = _level();
+	if (level == 0) level = 1;
+	ideal = ((uint64_t)_base * _reference) / level;
+
+	uint64_t ratio = ((uint64_t)ideal << 16) / max(_value, 1UL);		// Where we want to be, against where we are
+	bool outside = ratio > hysteresis || ratio * hysteresis < ((uint64_t)AMBIENT_ONE << 16);
+	if (outside) _tracking = true;
+
+	if (_tracking) {
+		uint64_t value;
+		if (ratio > max_step) value = ((uint64_t)_value * max_step) >> 16;
+		else if (ratio * max_step < ((uint64_t)AMBIENT_ONE << 16)) value = ((uint64_t)_value << 16) / max_step;
+		else {							// Within a step, land on it and stop
+			value		= ideal;
+			_tracking	= false;
+		}
+		_value = value > 0xFFFFFFFFULL ? 0xFFFFFFFFUL : (unsigned long)value;
+	}
+	_value = constrain(_value, floor, ceiling);
+
+	unsigned long error = ideal ? (unsigned long)(((uint64_t)(_value > ideal ? _value - ideal : ideal - _value) * 100) / ideal) : 0;
+	if (error > worst_error) worst_error = error;
+	_error_sum += error;
+	_frames++;
+
+	return _value;
+}
+
+#endif
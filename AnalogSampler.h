@@ -0,0 +1,264 @@
+/*
+ *  AnalogSampler.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Runs the ADC in the background for everything that wants it. The
+ *  Timer0 overflow that keeps millis() starts a conversion about once a
+ *  millisecond with no code involved. The conversion complete interrupt
+ *  hands the result to the channel it was for and points the multiplexer
+ *  at the next channel that wants one, round robin. Nothing waits on the
+ *  converter and analogRead() is never called.
+ *
+ *	The light sensor is the first channel. A burst of its conversions is
+ *	asked for from loop(), oversampled and decimated to 12 bits, then run
+ *	through a first order IIR low pass. Others, the keypad or a battery
+ *	monitor, are added with their own callback.
+ *
+ *	Can also play back a recorded light curve in place of the sensor,
+ *	to see how the automatic exposure tracks a sunset without waiting
+ *	for one.
+ *
+ */
+
+#ifndef AnalogSampler_h
+#define AnalogSampler_h
+
+#include "WProgram.h"
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "Timebase.h"
+
+#define SAMPLER_OVERSAMPLE		16		// Conversions per sample, 4^2 for two extra bits
+#define SAMPLER_DECIMATE		2		// Shift back down, 10 bits + 2
+#define SAMPLER_FILTER_SHIFT	3		// IIR: each sample moves the level 1/8 of the way
+#define SAMPLER_LEVEL_MAX		4095
+#define SAMPLER_CHANNELS		4
+
+typedef void (*SampleCallback)(unsigned int value);		// Called from the ADC interrupt
+
+struct SamplerChannel
+{
+	uint8_t				admux;
+	SampleCallback		callback;
+	volatile bool		wanted;			// Gets conversions; the light only during a burst
+};
+
+#define SUNSET_POINTS			33
+
+// A sunset as the sensor sees it: 8 stops down, eased in and out.
+const uint16_t kSunsetCurve[SUNSET_POINTS] PROGMEM = {
+	4000, 3937, 3758, 3488, 3152, 2780, 2398, 2027, 1682, 1373, 1105,
+	 879,  692,  540,  419,  324,  250,  193,  149,  116,   90,   71,
+	  57,   46,   37,   31,   26,   22,   20,   18,   17,   16,   16
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * AnalogSampler
+ * *  ---------------------------------------------------------
+ * *	Static, there is only the one ADC. Channels share it in
+ * *	turn, so with n of them wanting conversions each gets one
+ * *	every n milliseconds or so. Callbacks run in the interrupt,
+ * *	with interrupts on, and should be short.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class AnalogSampler
+{
+	public:
+		static void begin(uint8_t light_pin);
+		static uint8_t addChannel(uint8_t pin, SampleCallback callback, bool always = true);
+		static void want(uint8_t channel, bool on);
+
+		static void start();
+		static bool isBusy() { return _busy; }
+		static unsigned int level();
+
+		static void play(const uint16_t *curve, uint8_t points, unsigned long msecs_per_point);
+		static void stopPlaying() { _curve = NULL; }
+		static bool isPlaying() { return _curve != NULL; }
+
+		static void service();			// From the ISR only
+
+	private:
+		static SamplerChannel			_channels[SAMPLER_CHANNELS];
+		static uint8_t					_num_channels;
+		static volatile uint8_t			_current;	// Channel the conversion under way is for
+		static volatile bool			_running;	// Conversions are being triggered
+
+		static volatile bool			_busy;		// A burst is under way
+		static volatile bool			_primed;	// The filter has had its first sample
+		static volatile uint8_t			_count;
+		static volatile uint16_t		_sum;
+		static volatile unsigned long	_filtered;	// Level << 8
+
+		static const uint16_t			*_curve;	// Playing back, in PROGMEM
+		static uint8_t					_points;
+		static unsigned long			_step;
+		static unsigned long			_play_start;
+
+		static void lightSample(unsigned int value);
+		static void run();
+};
+
+SamplerChannel				AnalogSampler::_channels[SAMPLER_CHANNELS];
+uint8_t						AnalogSampler::_num_channels	= 0;
+volatile uint8_t			AnalogSampler::_current		= 0;
+volatile bool				AnalogSampler::_running		= false;
+volatile bool				AnalogSampler::_busy		= false;
+volatile bool				AnalogSampler::_primed		= false;
+volatile uint8_t			AnalogSampler::_count		= 0;
+volatile uint16_t			AnalogSampler::_sum			= 0;
+volatile unsigned long		AnalogSampler::_filtered	= 0;
+const uint16_t				*AnalogSampler::_curve		= NULL;
+uint8_t						AnalogSampler::_points		= 0;
+unsigned long				AnalogSampler::_step		= 0;
+unsigned long				AnalogSampler::_play_start	= 0;
+
+// Non-blocking, the keypad's classifier runs in here and the shutter
+// and step edges on Timer1 can't wait for it. The next conversion is a
+// Timer0 overflow away, so this can't come round again before it's done.
+ISR(ADC_vect, ISR_NOBLOCK)
+{
+	AnalogSampler::service();
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * AnalogSampler Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void AnalogSampler::begin(uint8_t light_pin)
+{
+	ADCSRA	= _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);	// clk/128, as analogRead() uses
+	ADCSRB	= _BV(ADTS2);								// Started by Timer0 overflow
+	addChannel(light_pin, lightSample, false);
+}
+
+//--------------------------------------
+//	+ addChannel
+//	Returns the channel's number. An always channel is converted for
+//	as long as the sketch runs; others only between want() calls.
+uint8_t AnalogSampler::addChannel(uint8_t pin, SampleCallback callback, bool always)
+{
+	if (_num_channels >= SAMPLER_CHANNELS) return SAMPLER_CHANNELS;
+
+	uint8_t channel = _num_channels;
+	_channels[channel].admux	= _BV(REFS0) | (pin & 0x07);	// AVcc reference, as analogRead() uses
+	_channels[channel].callback	= callback;
+	_channels[channel].wanted	= false;
+	_num_channels++;
+
+	if (always) want(channel, true);
+	return channel;
+}
+
+void AnalogSampler::want(uint8_t channel, bool on)
+{
+	if (channel >= _num_channels) return;
+
+	uint8_t sreg = SREG;
+	cli();
+	_channels[channel].wanted = on;
+	if (on && !_running) {
+		_current	= channel;
+		ADMUX		= _channels[channel].admux;
+		run();
+	}
+	SREG = sreg;
+}
+
+//--------------------------------------
+//	+ start
+//	Asks for a burst of light readings and returns. The ISR does the rest.
+void AnalogSampler::start()
+{
+	if (_busy) return;
+
+	uint8_t sreg = SREG;
+	cli();
+	_busy	= true;
+	_count	= 0;
+	_sum	= 0;
+	want(0, true);
+	SREG = sreg;
+}
+
+void AnalogSampler::run()
+{
+	_running = true;
+	ADCSRA |= _BV(ADEN) | _BV(ADATE) | _BV(ADIE);
+}
+
+//--------------------------------------
+//	+ service
+//	The conversion just finished was for _current. Its callback goes
+//	first, it may not want another. The next trigger is most of a
+//	millisecond away, plenty for the multiplexer to settle.
+void AnalogSampler::service()
+{
+	uint8_t done = _current;
+	_channels[done].callback(ADC);
+
+	uint8_t next = done;
+	for (uint8_t i = 0; i < _num_channels; i++) {
+		next = next + 1 < _num_channels ? next + 1 : 0;
+		if (_channels[next].wanted) break;
+	}
+	if (_channels[next].wanted) {
+		_current	= next;
+		ADMUX		= _channels[next].admux;
+	} else {
+		ADCSRA		&= ~(_BV(ADATE) | _BV(ADIE));	// Nobody wants any more
+		_running	= false;
+	}
+}
+
+void AnalogSampler::lightSample(unsigned int value)
+{
+	_sum += value;
+	if (++_count < SAMPLER_OVERSAMPLE) return;
+
+	unsigned long sample = (unsigned long)(_sum >> SAMPLER_DECIMATE) << 8;
+	if (!_primed) {
+		_filtered	= sample;
+		_primed		= true;
+	} else _filtered = _filtered + ((long)(sample - _filtered) >> SAMPLER_FILTER_SHIFT);
+
+	_channels[0].wanted	= false;
+	_busy				= false;
+}
+
+//--------------------------------------
+//	+ level
+//	Filtered light level, 0-4095. While playing back, the recorded
+//	curve interpolated at the time since play() instead.
+unsigned int AnalogSampler::level()
+{
+	if (_curve) {
+		unsigned long t	= Timebase::elapsed(_play_start);
+		unsigned long i	= t / _step;
+		if (i >= (unsigned long)_points - 1) return pgm_read_word(&_curve[_points - 1]);
+
+		long a = pgm_read_word(&_curve[i]);
+		long b = pgm_read_word(&_curve[i + 1]);
+		return a + (b - a) * (long)(t - i*_step) / (long)_step;
+	}
+
+	uint8_t sreg = SREG;
+	cli();
+	unsigned long filtered = _filtered;
+	SREG = sreg;
+	return filtered >> 8;
+}
+
+void AnalogSampler::play(const uint16_t *curve, uint8_t points, unsigned long msecs_per_point)
+{
+	if (points < 2 || msecs_per_point == 0) return;
+
+	_curve		= curve;
+	_points		= points;
+	_step		= msecs_per_point;
+	_play_start	= Timebase::now();
+}
+
+#endif
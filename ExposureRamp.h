@@ -0,0 +1,120 @@
+/*
+ *  ExposureRamp.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Bulb ramping, for day to night (and back) sequences. Exposure moves
+ *  from one length to another over a number of frames, evenly in EV or
+ *  eased in and out, while the interval stays put.
+ *
+ *	The curve is worked out once, in floats, into a short table of
+ *	segments. Each segment has its starting exposure and a fixed-point
+ *	per-frame multiplier, so a frame costs one integer multiply and the
+ *	rounding is thrown away at every segment boundary.
+ *
+ */
+
+#ifndef ExposureRamp_h
+#define ExposureRamp_h
+
+#include "WProgram.h"
+#include <math.h>
+
+#define RAMP_SEGMENTS		16
+#define RAMP_FRACTION_BITS	24		// Multipliers are Q8.24
+
+enum eRampCurve { kRampOff, kRampLinear, kRampEase };
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * ExposureRamp
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class ExposureRamp
+{
+	public:
+		ExposureRamp();
+
+		void setup(unsigned long start_us, unsigned long end_us, unsigned long frames, eRampCurve curve);
+		void stop() { _active = false; }
+		bool isActive() { return _active; }
+
+		unsigned long next();					// Exposure for this frame, in microseconds
+		unsigned long current() { return _exposure; }
+		unsigned long framesLeft() { return _active ? _frames - _frame : 0; }
+
+	private:
+		unsigned long	_anchor[RAMP_SEGMENTS + 1];	// Exposure at the start of each segment, us
+		unsigned long	_mult[RAMP_SEGMENTS];		// Per-frame multiplier within each segment, Q8.24
+		unsigned long	_frames;
+		unsigned long	_segment_len;
+		uint8_t			_segments;
+
+		bool			_active;
+		unsigned long	_frame;					// Frames into the ramp
+		unsigned long	_segment_frame;			// Frames into the current segment
+		uint8_t			_segment;
+		unsigned long	_exposure;				// us
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * ExposureRamp Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+ExposureRamp::ExposureRamp()
+{
+	_active		= false;
+	_frames		= 0;
+	_exposure	= 0;
+}
+
+//--------------------------------------
+//	+ setup
+//	Builds the segment table. The only float work the ramp does.
+void ExposureRamp::setup(unsigned long start_us, unsigned long end_us, unsigned long frames, eRampCurve curve)
+{
+	_exposure		= start_us;
+	_frame			= 0;
+	_segment		= 0;
+	_segment_frame	= 0;
+	_active			= (curve != kRampOff && frames > 0 && start_us > 0 && end_us > 0);
+	if (!_active) return;
+
+	_frames			= frames;
+	_segment_len	= (frames + RAMP_SEGMENTS - 1) / RAMP_SEGMENTS;
+	_segments		= (frames + _segment_len - 1) / _segment_len;
+
+	float ev = log((float)end_us / start_us) / log(2.0f);	// Stops to cover
+	for (uint8_t k = 0; k <= _segments; k++) {
+		float t = (k == _segments) ? 1.0f : (float)(k * _segment_len) / frames;
+		if (curve == kRampEase) t = t * t * (3.0f - 2.0f*t);	// Smoothstep
+		_anchor[k] = (k == _segments) ? end_us : (unsigned long)(start_us * pow(2.0f, ev*t) + 0.5f);
+	}
+	for (uint8_t k = 0; k < _segments; k++) {
+		unsigned long len = (k == _segments - 1) ? frames - k*_segment_len : _segment_len;
+		float step = pow((float)_anchor[k+1] / _anchor[k], 1.0f / len);
+		_mult[k] = (unsigned long)(step * (1UL << RAMP_FRACTION_BITS) + 0.5f);
+	}
+}
+
+//--------------------------------------
+//	+ next
+//	Returns this frame's exposure and steps the ramp on by one frame.
+//	After the last frame the ramp holds its end exposure.
+unsigned long ExposureRamp::next()
+{
+	unsigned long exposure = _exposure;
+	if (!_active) return exposure;
+
+	_frame++;
+	if (++_segment_frame >= _segment_len || _frame >= _frames) {
+		_segment++;
+		_segment_frame	= 0;
+		_exposure		= _anchor[_segment];		// Re-anchor, dropping any rounding
+		if (_frame >= _frames) _active = false;
+	} else {
+		_exposure = ((uint64_t)_exposure * _mult[_segment]) >> RAMP_FRACTION_BITS;
+	}
+	return exposure;
+}
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ *  ExternalTrigger.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Fires the shutter on an outside edge: a sound or lightning sensor,
+ *  an IR beam. The edge comes in on INT0 (pin 2), INT1 (pin 3) or the
+ *  analog comparator (AIN0 pin 6 against a threshold on AIN1 pin 7),
+ *  and the interrupt writes the shutter's port register itself. No
+ *  digitalWrite(), no menu, no scheduler between the edge and the camera.
+ *
+ *	Releasing the shutter and re-arming happen later from loop(), with
+ *	the release timed by ShutterTimer from the tick the shutter opened,
+ *	so it needs USE_TIMER1_SHUTTER.
+ *
+ */
+
+#ifndef ExternalTrigger_h
+#define ExternalTrigger_h
+
+#include "WProgram.h"
+#include <avr/interrupt.h>
+#include "Timebase.h"
+#include "ShutterTimer.h"
+
+#define TRIGGER_BINS		8		// Latency histogram bins, the last one catches everything longer
+#define TRIGGER_BIN_US		8		// Width of a histogram bin
+
+enum eTriggerSource { kTriggerOff, kTriggerINT0, kTriggerINT1, kTriggerComparator };
+enum eTriggerState { kTriggerIdle, kTriggerArmed, kTriggerFired, kTriggerHoldoff };
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * ExternalTrigger
+ * *  ---------------------------------------------------------
+ * *	Static, the interrupts are one of a kind. An edge disarms
+ * *	the source straight away, so bounce and noise during the
+ * *	exposure and holdoff cost nothing.
+ * *
+ * *	Latency is measured in Timer1 ticks from the port write back
+ * *	to the edge, and only for the comparator, whose edge Timer1's
+ * *	input capture stamps in hardware. INT0/INT1 have nothing to
+ * *	stamp theirs with: TCNT1 read in the ISR is already past the
+ * *	interrupt's entry, so all it would time is the port write.
+ * *	Their triggers are counted, but kept out of the latency stats.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class ExternalTrigger
+{
+	public:
+		static void begin(uint8_t focus_pin, uint8_t shutter_pin);
+		static void setSource(eTriggerSource source, bool rising = true);
+		static eTriggerSource getSource() { return _source; }
+		static void setPrefocus(bool on);
+
+		static void service();
+		static void fire(bool captured);	// From the ISRs only. captured: ICR1 holds the edge's tick
+		static void reset();
+
+		static unsigned long	press_us;		// How long the shutter is held
+		static unsigned long	holdoff;		// Msecs after the release before the next edge counts
+
+		static unsigned long	triggers;
+		static unsigned long	timed;			// Triggers with a captured edge, the ones in the stats below
+		static unsigned long	worst_latency;	// us
+		static unsigned long	latency_sum;	// us, for the mean
+		static unsigned int		histogram[TRIGGER_BINS];
+
+	private:
+		static volatile uint8_t	*_port;			// The shutter pin, for writing directly
+		static uint8_t			_mask;
+		static uint8_t			_focus_pin;
+		static uint8_t			_shutter_pin;
+		static bool				_prefocus;
+		static bool				_rising;
+		static eTriggerSource	_source;
+
+		static volatile eTriggerState	_state;
+		static volatile unsigned long	_fire_tick;
+		static volatile unsigned int	_latency_ticks;
+		static volatile bool			_timed;		// _latency_ticks is from a captured edge
+		static unsigned long			_rearm_at;	// micros()
+
+		static void arm();
+		static void disarm();
+};
+
+volatile uint8_t		*ExternalTrigger::_port			= NULL;
+uint8_t					ExternalTrigger::_mask			= 0;
+uint8_t					ExternalTrigger::_focus_pin		= 0;
+uint8_t					ExternalTrigger::_shutter_pin	= 0;
+bool					ExternalTrigger::_prefocus		= false;
+bool					ExternalTrigger::_rising		= true;
+eTriggerSource			ExternalTrigger::_source		= kTriggerOff;
+volatile eTriggerState	ExternalTrigger::_state			= kTriggerIdle;
+volatile unsigned long	ExternalTrigger::_fire_tick		= 0;
+volatile unsigned int	ExternalTrigger::_latency_ticks	= 0;
+volatile bool			ExternalTrigger::_timed			= false;
+unsigned long			ExternalTrigger::_rearm_at		= 0;
+unsigned long			ExternalTrigger::press_us		= 200000;
+unsigned long			ExternalTrigger::holdoff		= 500;
+unsigned long			ExternalTrigger::triggers		= 0;
+unsigned long			ExternalTrigger::timed			= 0;
+unsigned long			ExternalTrigger::worst_latency	= 0;
+unsigned long			ExternalTrigger::latency_sum	= 0;
+unsigned int			ExternalTrigger::histogram[TRIGGER_BINS];
+
+ISR(INT0_vect)
+{
+	ExternalTrigger::fire(false);
+}
+
+ISR(INT1_vect)
+{
+	ExternalTrigger::fire(false);
+}
+
+ISR(ANALOG_COMP_vect)
+{
+	ExternalTrigger::fire(true);			// Timer1 captured the comparator edge itself
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * ExternalTrigger Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void ExternalTrigger::begin(uint8_t focus_pin, uint8_t shutter_pin)
+{
+	_focus_pin		= focus_pin;
+	_shutter_pin	= shutter_pin;
+	_port			= portOutputRegister(digitalPinToPort(shutter_pin));
+	_mask			= digitalPinToBitMask(shutter_pin);
+	reset();
+}
+
+//--------------------------------------
+//	+ fire
+//	The fast path. Shutter first, bookkeeping after.
+void ExternalTrigger::fire(bool captured)
+{
+	*_port |= _mask;
+	unsigned int done = TCNT1;
+
+	disarm();
+	_fire_tick		= ShutterTimer::ticks();
+	_latency_ticks	= captured ? done - ICR1 : 0;
+	_timed			= captured;
+	_state			= kTriggerFired;
+}
+
+//--------------------------------------
+//	+ setSource
+//	Turns the trigger off, or on for a source and edge. A shot that's
+//	fired but hasn't had its release scheduled yet is let go here,
+//	since leaving kTriggerFired means service() never will. Leaving
+//	the comparator gives pins 6 and 7 their digital inputs back.
+void ExternalTrigger::setSource(eTriggerSource source, bool rising)
+{
+	disarm();
+	if (_state == kTriggerFired) digitalWrite(_shutter_pin, LOW);
+	if (_source == kTriggerComparator && source != kTriggerComparator)
+		DIDR1 &= ~(_BV(AIN1D) | _BV(AIN0D));	// Pins 6 and 7 digital again
+	_source	= source;
+	_rising	= rising;
+
+	if (_source == kTriggerOff) {
+		_state = kTriggerIdle;
+		digitalWrite(_focus_pin, LOW);
+		return;
+	}
+	ShutterTimer::begin();
+	if (_prefocus) digitalWrite(_focus_pin, HIGH);
+	arm();
+}
+
+//--------------------------------------
+//	+ setPrefocus
+//	Holds the focus line (half press) the whole time the trigger is
+//	on, so the camera has metered and focused before the edge comes
+//	and only the shutter lag is left.
+void ExternalTrigger::setPrefocus(bool on)
+{
+	_prefocus = on;
+	digitalWrite(_focus_pin, (on && _source != kTriggerOff) ? HIGH : LOW);
+}
+
+//--------------------------------------
+//	+ service
+//	Call from loop() while a source is set, well inside press_us.
+//	Times the release from when the shutter opened, counts the shot
+//	and re-arms after the holdoff.
+void ExternalTrigger::service()
+{
+	if (_state == kTriggerFired) {
+		if (!ShutterTimer::schedule(_shutter_pin, LOW, _fire_tick + ShutterTimer::ticksFor(press_us)))
+			digitalWrite(_shutter_pin, LOW);	// Queue's full. A short shot beats a shutter held open.
+
+		if (_timed) {
+			unsigned long latency = (unsigned long)_latency_ticks * kMicrosPerTick;
+			uint8_t bin = latency / TRIGGER_BIN_US;
+			histogram[bin < TRIGGER_BINS ? bin : TRIGGER_BINS - 1]++;
+			if (latency > worst_latency) worst_latency = latency;
+			latency_sum += latency;
+			timed++;
+		}
+		triggers++;
+
+		_rearm_at	= Timebase::nowMicros() + press_us + holdoff*1000UL;
+		_state		= kTriggerHoldoff;
+	}
+	if (_state == kTriggerHoldoff && Timebase::reachedMicros(_rearm_at)) arm();
+}
+
+void ExternalTrigger::reset()
+{
+	triggers		= 0;
+	timed			= 0;
+	worst_latency	= 0;
+	latency_sum		= 0;
+	for (uint8_t i = 0; i < TRIGGER_BINS; i++) histogram[i] = 0;
+}
+
+void ExternalTrigger::arm()
+{
+	uint8_t sreg = SREG;
+	cli();
+	switch (_source) {
+		case kTriggerINT0:
+			EICRA	= (EICRA & ~(_BV(ISC01) | _BV(ISC00))) | _BV(ISC01) | (_rising ? _BV(ISC00) : 0);
+			EIFR	= _BV(INTF0);				// Forget edges from before we were armed
+			EIMSK	|= _BV(INT0);
+			break;
+
+		case kTriggerINT1:
+			EICRA	= (EICRA & ~(_BV(ISC11) | _BV(ISC10))) | _BV(ISC11) | (_rising ? _BV(ISC10) : 0);
+			EIFR	= _BV(INTF1);
+			EIMSK	|= _BV(INT1);
+			break;
+
+		case kTriggerComparator:
+			DIDR1	= _BV(AIN1D) | _BV(AIN0D);	// Analog only on pins 6 and 7
+			TCCR1B	= _rising ? (TCCR1B | _BV(ICES1)) : (TCCR1B & ~_BV(ICES1));
+			ACSR	= _BV(ACI) | _BV(ACIC) | _BV(ACIS1) | (_rising ? _BV(ACIS0) : 0);
+			ACSR	|= _BV(ACIE);
+			break;
+
+		default:
+			SREG = sreg;
+			return;
+	}
+	_state = kTriggerArmed;
+	SREG = sreg;
+}
+
+void ExternalTrigger::disarm()
+{
+	EIMSK	&= ~(_BV(INT0) | _BV(INT1));
+	ACSR	&= ~_BV(ACIE);
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ *  IntervalProgram.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Keyframed intervals. A program is a packed table of segments, e.g.
+ *	"300 frames @ 2 s, ease to 30 s over 200 frames, 500 frames @ 30 s",
+ *	kept in PROGMEM or EEPROM and read back one segment at a time.
+ *
+ *	Each frame costs the same: a fixed-point cursor steps through a
+ *	33 point curve table and interpolates between its entries. The only
+ *	division happens once per segment.
+ *
+ */
+
+#ifndef IntervalProgram_h
+#define IntervalProgram_h
+
+#include "WProgram.h"
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+
+#define PROGRAM_CURVE_POINTS	32				// Intervals between curve table entries
+#define PROGRAM_EEPROM_MAGIC	0xA7
+#define PROGRAM_MAX_SEGMENTS	16				// Most segments an EEPROM program can hold
+
+enum eProgramCurve { kCurveHold, kCurveLinear, kCurveEase };
+enum eProgramSource { kProgramOff, kProgramFlash, kProgramEEPROM };
+
+struct ProgramSegment
+{
+	uint16_t	frames;			// Frames in this segment
+	uint32_t	interval;		// Interval the segment ends on, ms
+	uint8_t		curve;			// eProgramCurve, how to get there from the last segment's interval
+};
+
+// Smoothstep, 0-65535, sampled at PROGRAM_CURVE_POINTS + 1 points
+const uint16_t kEaseCurve[PROGRAM_CURVE_POINTS + 1] PROGMEM = {
+	0, 188, 736, 1620, 2816, 4300, 6048, 8036, 10240, 12636, 15200,
+	17908, 20736, 23660, 26656, 29700, 32768, 35835, 38879, 41875, 44799,
+	47627, 50335, 52899, 55295, 57499, 59487, 61235, 62719, 63915, 64799,
+	65347, 65535
+};
+
+// The built in program: 300 @ 2 s, ease to 30 s over 200, 500 @ 30 s
+const ProgramSegment kDefaultProgram[] PROGMEM = {
+	{ 300,	2000,	kCurveHold },
+	{ 200,	30000,	kCurveEase },
+	{ 500,	30000,	kCurveHold }
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * IntervalProgram
+ * *  ---------------------------------------------------------
+ * *	EEPROM layout at the given address: magic byte, segment
+ * *	count, then the segments as stored in RAM.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class IntervalProgram
+{
+	public:
+		IntervalProgram();
+
+		bool loadFlash(const ProgramSegment *table, uint8_t count);
+		bool loadEEPROM(int address);
+		bool saveEEPROM(int address);
+		void stop() { _source = kProgramOff; }
+
+		bool isActive() { return _source != kProgramOff; }
+		bool isFinished() { return isActive() && _index >= _count; }
+		eProgramSource getSource() { return _source; }
+
+		unsigned long first();					// Interval before the first frame, rewinds the cursor
+		unsigned long next();					// Interval after this frame, steps the cursor
+
+	private:
+		eProgramSource	_source;
+		const ProgramSegment *_table;
+		int				_address;
+		uint8_t			_count;
+
+		uint8_t			_index;					// Current segment
+		ProgramSegment	_segment;				// Copy of it out of flash/EEPROM
+		unsigned long	_from;					// Interval the segment starts from, ms
+		uint16_t		_frame;					// Frames into the segment
+		unsigned long	_pos;					// Curve position, Q16 curve points
+		unsigned long	_step;					// Curve advance per frame
+
+		void fetch(uint8_t index, ProgramSegment *segment);
+		void enter(uint8_t index, unsigned long from);
+		unsigned long interpolate();
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * IntervalProgram Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+IntervalProgram::IntervalProgram()
+{
+	_source		= kProgramOff;
+	_table		= NULL;
+	_address	= 0;
+	_count		= 0;
+	_index		= 0;
+}
+
+bool IntervalProgram::loadFlash(const ProgramSegment *table, uint8_t count)
+{
+	if (count == 0) return false;
+
+	_table	= table;
+	_count	= count;
+	_source	= kProgramFlash;
+	first();
+	return true;
+}
+
+bool IntervalProgram::loadEEPROM(int address)
+{
+	uint8_t count = eeprom_read_byte((uint8_t *)address + 1);
+	if (eeprom_read_byte((uint8_t *)address) != PROGRAM_EEPROM_MAGIC || count == 0 || count > PROGRAM_MAX_SEGMENTS)
+		return false;
+
+	_address	= address;
+	_count		= count;
+	_source		= kProgramEEPROM;
+	first();
+	return true;
+}
+
+//--------------------------------------
+//	+ saveEEPROM
+//	Copies the loaded program into EEPROM, so a program picked from
+//	flash can be kept and reloaded as the user's own.
+bool IntervalProgram::saveEEPROM(int address)
+{
+	if (!isActive() || _count > PROGRAM_MAX_SEGMENTS) return false;
+
+	ProgramSegment segment;
+	for (uint8_t i = 0; i < _count; i++) {
+		fetch(i, &segment);
+		eeprom_write_block(&segment, (uint8_t *)address + 2 + i*sizeof(ProgramSegment), sizeof(ProgramSegment));
+	}
+	eeprom_write_byte((uint8_t *)address + 1, _count);
+	eeprom_write_byte((uint8_t *)address, PROGRAM_EEPROM_MAGIC);	// Last, so a torn save doesn't load
+	return true;
+}
+
+void IntervalProgram::fetch(uint8_t index, ProgramSegment *segment)
+{
+	if (_source == kProgramEEPROM)
+		eeprom_read_block(segment, (uint8_t *)_address + 2 + index*sizeof(ProgramSegment), sizeof(ProgramSegment));
+	else
+		memcpy_P(segment, &_table[index], sizeof(ProgramSegment));
+}
+
+//--------------------------------------
+//	+ enter
+//	Moves the cursor to the start of a segment. Works out the curve
+//	step for it, the one division per segment.
+void IntervalProgram::enter(uint8_t index, unsigned long from)
+{
+	_index	= index;
+	_from	= from;
+	_frame	= 0;
+	_pos	= 0;
+	if (_index >= _count) return;
+
+	fetch(_index, &_segment);
+	_step	= _segment.frames ? ((unsigned long)PROGRAM_CURVE_POINTS << 16) / _segment.frames : 0;
+}
+
+unsigned long IntervalProgram::first()
+{
+	if (!isActive()) return 0;
+
+	ProgramSegment segment;
+	fetch(0, &segment);
+	enter(0, segment.interval);			// The first segment starts from its own interval
+	return interpolate();
+}
+
+//--------------------------------------
+//	+ next
+//	Steps the cursor one frame and returns the interval to wait before
+//	the following one. Holds the last interval once the program is done.
+unsigned long IntervalProgram::next()
+{
+	if (!isActive() || _index >= _count) return _from;
+
+	if (++_frame >= _segment.frames) {
+		unsigned long end = _segment.interval;
+		do {
+			enter(_index + 1, end);
+		} while (_index < _count && _segment.frames == 0);
+		return end;
+	}
+	_pos += _step;
+	return interpolate();
+}
+
+//--------------------------------------
+//	+ interpolate
+//	Interval at the cursor, _frame frames into the segment. Linear or
+//	eased between the segment's start and end interval, the ease read
+//	from the curve table and blended between its neighbouring entries.
+unsigned long IntervalProgram::interpolate()
+{
+	if (_index >= _count) return _from;
+
+	unsigned long y;					// 0-65536 along the curve
+	switch (_segment.curve) {
+		case kCurveLinear:
+			y = _pos / PROGRAM_CURVE_POINTS;
+			break;
+
+		case kCurveEase: {
+			uint8_t i		= _pos >> 16;	// Never the last point, next() returns the keyframe itself
+			unsigned int a	= pgm_read_word(&kEaseCurve[i]);
+			unsigned int b	= pgm_read_word(&kEaseCurve[i + 1]);
+			y = a + (((unsigned long)(b - a) * (_pos & 0xFFFF)) >> 16);
+			break;
+		}
+
+		default:
+			return _segment.interval;	// Hold
+	}
+
+	long span = (long)(_segment.interval - _from);
+	return _from + (long)(((int64_t)span * (long)y) >> 16);
+}
+
+#endif
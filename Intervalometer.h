@@ -15,6 +15,31 @@
 #define Intervalometer_h
 
 #include "WProgram.h"
+#include "intervalomedio.h"
+#include "Timebase.h"
+#include "ExposureRamp.h"
+#include "IntervalProgram.h"
+#include "ShutterLog.h"
+#include "AmbientExposure.h"
+
+#ifdef USE_TIMER1_SHUTTER
+#include "ShutterTimer.h"
+#include "StepperAxis.h"
+#include "MotionPath.h"
+#else
+class StepperAxis;
+class MotionPath;
+#endif
+
+#define SHUTTER_ARM_LEAD	2000	// ms before a slot that its edges are handed to Timer1
+#define AMBIENT_MIN_LAPSE	500			// ms, shortest interval the light may pull us down to
+#define AMBIENT_MAX_LAPSE	3600000UL	// ms, and the longest
+#define LATE_SLACK			1000	// us past its slot before a frame counts as late
+#define BRACKET_MAX			7		// Most shots in a bracketed burst, edges for all of them must fit in Timer1's queue
+#define SHOT_MAX_US			2000000000UL	// Longest single shot, us. Phase deadlines are micros(), only safe inside 2^31
+
+// 2^(n/3) in Q16, for bracketing in thirds of a stop
+const unsigned long kThirdStops[3] = { 65536UL, 82570UL, 104032UL };
 
 
 typedef unsigned long ulong;
@@ -23,25 +48,58 @@ typedef unsigned long ulong;
  * * * Intervalometer Prototype
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+enum eShutterPhase { kPhaseIdle, kPhaseFocus, kPhaseWakeWait, kPhaseShutter, kPhaseGap, kPhaseArmed };
+enum eShutterBackend { kBackendPolling, kBackendTimer1 };	// Who writes the pins: loop() or the Timer1 ISR
+enum eLatePolicy { kLateFire, kLateSkip, kLateShift };	// What to do with a frame whose slot has already passed
+enum eMotionMode { kMotionShootMove, kMotionContinuous };	// Slider moves between frames, or crawls through them
+
 class Intervalometer 
 {
 	public:
-		int lapse_time;			// Delay between exposures, in seconds
-		int exposure_time;		// Exposure. 1000 = 1 sec
+		unsigned long lapse_time;		// Delay between exposures, in milliseconds
+		unsigned long exposure_time;	// Exposure. 1000 = 1 sec
+		unsigned long start_delay;		// Wait from start() to the first frame, in milliseconds
 		
 
 		int shutter_on;			// time to press shutter, set between 100 and 300
-		int shutter_wait;		// Initial time to wait to begin sequence
 		int wakeup;			  	// Time to activate wakeup (focus)
 		int wake_wait;		 	// Time between wake and shutter
+		int camera_overhead;	// Time the camera needs after an exposure before it will take another
 
-		int frame_limit;		// Number of frames at which to stop
-		int frame_count;
+		long frame_limit;		// Number of frames at which to stop
+		long frame_count;
 		
 		bool focus;
+		bool bulb;				// Hold the shutter for exposure_time rather than shutter_on
 		bool active;
 
-		unsigned long previous_time;	// Previous shutter click (from start of the exposure)
+		eLatePolicy late_policy;	// kLateFire: fire as soon as we can, keep the grid. kLateSkip: drop slots
+									// missed by more than late_tolerance. kLateShift: fire now, move the grid along.
+		int late_tolerance;			// Milliseconds a slot may be missed by before kLateSkip drops it
+		unsigned long missed_frames;	// Slots dropped this session
+		unsigned long late_frames;		// Frames fired more than LATE_SLACK after their slot
+		unsigned long worst_late;		// Latest any slot was got to this session, us
+
+		ExposureRamp ramp;		// Bulb ramping, takes over from exposure_time while active
+		unsigned long refused_frames;	// Ramp frames that wouldn't have fit in the interval
+		IntervalProgram program;	// Keyframed intervals, sets lapse_time frame by frame while active
+		AmbientExposure ambient;	// Follows the light, sets the exposure or the interval frame by frame while active
+		
+		uint8_t bracket_shots;		// Bulb shots per slot, odd. 1 for no bracketing
+		uint8_t bracket_step;		// EV between bracketed shots, in thirds of a stop
+		unsigned long burst_overruns;	// Slots whose burst didn't fit in the interval
+		
+		ShutterLog shutter_log;		// Every shutter edge this session, against when it was planned
+		
+		StepperAxis *axis;			// Slider moved between frames, or NULL. Needs USE_TIMER1_SHUTTER.
+		MotionPath *path;			// Keyframes for it. While it has any, they replace move_steps.
+		eMotionMode motion_mode;
+		long move_steps;			// Steps to move after each frame. kMotionContinuous only takes the direction.
+		unsigned int settle_time;	// Milliseconds for the rig to stop shaking after a move
+		unsigned long crawl_period;	// kMotionContinuous, milliseconds per step
+		unsigned long motion_overruns;	// Moves that couldn't finish and settle before their frame
+		
+		time64_t previous_time;	// Previous shutter click (from start of the exposure), Timebase::millis64()
 		
 		Intervalometer();
 		Intervalometer(int in_focus_pin, int in_shutter_pin);
@@ -55,10 +113,50 @@ class Intervalometer
 		void stop();
 		
 		void setInterval(float seconds);
+		void setExposure(unsigned long msecs);
+		void setBulb(bool on);
+		bool setProgram(eProgramSource source);
+		bool saveProgram();
+		bool setBracket(uint8_t shots, uint8_t step);
+		unsigned long shotExposure(uint8_t shot);
+		unsigned long burstTime();			// ms
+		void startRamp(unsigned long end_msecs, unsigned long duration_secs, eRampCurve curve);
+		void startAmbient(eAmbientMode mode);
+		void setBackend(eShutterBackend new_backend);
+		eShutterBackend getBackend() { return _backend; }
+		
+		bool isBusy() { return _phase != kPhaseIdle; }
+		unsigned long pressTime() { return bulb ? exposure_time : (unsigned long)shutter_on; }	// ms the shutter line is held
+		unsigned long leadTime() { return focus ? (unsigned long)(wakeup + wake_wait) : 0; }	// ms the focus pulse starts ahead of a slot
+		time64_t nextSlot() { return _start_micros + (time64_t)_frame_index * lapse_time * 1000UL; }	// Timebase::micros64()
+		time64_t nextWake();
+		unsigned long delayRemaining();
 		
 	private:
 		int focus_pin;			// The focus pin is also used to wake up the camera
 		int shutter_pin;
+		
+		time64_t		_start_micros;		// Timebase::micros64() of the first slot of the session
+		unsigned long	_frame_index;		// Slot on the start + n * lapse_time grid of the next frame
+		
+		eShutterPhase	_phase;				// Where we are within the current frame
+		unsigned long	_phase_deadline;	// micros() at which the current phase ends
+		eShutterBackend	_backend;
+		unsigned long	_base_us;			// This frame's exposure, before bracketing
+		unsigned long	_press_us;			// How long the current shot holds the shutter
+		uint8_t			_shot;				// Shot within a bracketed burst
+		time64_t		_settled_at;		// Timebase::micros64() the last move should be over and still by
+		
+		bool planFrame();
+		bool handleLate(int64_t late);
+		void beginMove();
+		bool isSettled();
+		void setLapse(unsigned long msecs);
+		
+		void beginFocus(unsigned long when);	// when and the phase deadlines are 32-bit micros()
+		void pressShutter(unsigned long when);
+		void armFrame(unsigned long when);
+		void stepPhase();
 };
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -71,56 +169,370 @@ class Intervalometer
 Intervalometer::Intervalometer(int in_focus_pin = 9, int in_shutter_pin = 7) 
 {
 	lapse_time		= 1000;          
+	exposure_time	= 250;
+	start_delay		= 0;
 
 	focus_pin		= in_focus_pin;        
 	shutter_pin		= in_shutter_pin;
 
 	shutter_on		= 200;     
-	shutter_wait	= 5000;	
 	wakeup			= 300;	
 	wake_wait		= 200;  
+	camera_overhead	= 200;
+	refused_frames	= 0;
+	
+	bracket_shots	= 1;
+	bracket_step	= 6;
+	burst_overruns	= 0;
 	
 	focus			= false;
+	bulb			= false;
 	active			= true;
 	
+	late_policy		= kLateFire;
+	late_tolerance	= 1000;
+	missed_frames	= 0;
+	late_frames		= 0;
+	worst_late		= 0;
+	
+	axis			= NULL;
+	path			= NULL;
+	motion_mode		= kMotionShootMove;
+	move_steps		= 0;
+	settle_time		= 500;
+	crawl_period	= 1000;
+	motion_overruns	= 0;
+	_settled_at		= 0;
+	
 	previous_time	= 0;
 	frame_count		= 0;
 	frame_limit		= -1;
 	
+	_start_micros	= 0;
+	_frame_index	= 0;
+	
+	_phase			= kPhaseIdle;
+	_phase_deadline	= 0;
+	_backend		= kBackendPolling;
+	_base_us		= 0;
+	_press_us		= 0;
+	_shot			= 0;
+	
  	pinMode(shutter_pin, OUTPUT);
 	pinMode(focus_pin, OUTPUT);
+	
+#ifdef USE_TIMER1_SHUTTER
+	setBackend(kBackendTimer1);
+#endif
 }
 
 void Intervalometer::loop() 
 {
-	if (active && millis() - previous_time > lapse_time) {
-		// Could take into account wakeup/focus time and substract from lapse_time above?
-		if (focus) wakeAndFocus();
-		triggerShutter();
-		
-		if (frame_limit != -1 && frame_count >= frame_limit)
-	   		stop();
+	shutter_log.update();				// Fold in edges stamped since last time, before the ring wraps
+	stepPhase();						// Advance a frame that is already under way
+	
+	if (!active || _phase != kPhaseIdle) return;
+	if (program.isFinished()) {			// Its last frame is done
+		stop();
+		return;
 	}
+	
+	// Frames sit on an absolute grid, start + n * lapse_time, so a late pass
+	// through here delays that one frame but never the ones after it. The
+	// slot is when the shutter closes; wake/focus starts leadTime() earlier.
+	// The Timer1 backend is handed the frame ahead of time and writes the edges itself.
+	int64_t late = (int64_t)(Timebase::micros64() + leadTime()*1000UL - nextSlot());
+	if (late < (_backend == kBackendTimer1 ? -SHUTTER_ARM_LEAD*1000L : 0)) return;
+	
+#ifdef USE_TIMER1_SHUTTER
+	// Other cameras share the queue. Leave the slot until there's room for all of this one.
+	if (_backend == kBackendTimer1 && ShutterTimer::room() < 2*bracket_shots + (focus ? 2 : 0)) return;
+#endif
+	if (!isSettled()) return;			// Shoot-move-shoot, still moving. Counts as late once it fires.
+	if (late > LATE_SLACK && !handleLate(late)) return;
+	
+	unsigned long slot = (unsigned long)nextSlot();
+	if (late > LATE_SLACK) slot = Timebase::nowMicros() + leadTime()*1000UL;	// Counted above. Planned from now, so focus and exposure still run full length
+	_frame_index++;
+	if (program.isActive()) setLapse(program.next());
+	else if (ambient.getMode() == kAmbientInterval) setLapse(ambient.next(AMBIENT_MIN_LAPSE, AMBIENT_MAX_LAPSE));
+	if (!planFrame()) return;
+	
+	if (_backend == kBackendTimer1) armFrame(slot);
+	else if (focus) beginFocus(slot - leadTime()*1000UL);
+	else pressShutter(slot);
 }
 
-void Intervalometer::triggerShutter() 
+//--------------------------------------
+//	+ handleLate
+//	A slot got to late usecs after its time. Applies the late policy
+//	and keeps the session's counters. Returns false if the slot was
+//	dropped rather than fired.
+bool Intervalometer::handleLate(int64_t late) 
+{
+	unsigned long lapse_us = lapse_time*1000UL;
+	if (late > (int64_t)worst_late) worst_late = late > 0xFFFFFFFFLL ? 0xFFFFFFFFUL : (unsigned long)late;
+	
+	switch (late_policy) {
+		case kLateSkip:
+			if (late <= late_tolerance*1000L) break;	// Close enough, fire it
+			if (program.isActive() || lapse_us == 0) {	// Each slot has its own interval, so drop them one at a time
+				_frame_index++;
+				missed_frames++;
+				if (program.isActive()) setLapse(program.next());
+			} else {							// Drop the slots missed by too much, wait for the first that isn't
+				unsigned long passed = (late - late_tolerance*1000L + lapse_us - 1) / lapse_us;
+				_frame_index	+= passed;
+				missed_frames	+= passed;
+			}
+			return false;
+			
+		case kLateShift:
+			_start_micros += late;				// This slot becomes now, and the rest follow on from it
+			break;
+			
+		default:								// kLateFire
+			if (!program.isActive() && lapse_us > 0 && late >= lapse_us) {	// Fire the latest slot that's gone by, not all of them
+				unsigned long passed = late / lapse_us;
+				_frame_index	+= passed;
+				missed_frames	+= passed;
+			}
+			break;
+	}
+	late_frames++;
+	return true;
+}
+
+//--------------------------------------
+//	+ nextWake
+//	When loop() next has anything to do, in Timebase::micros64(). Lets
+//	a rig of cameras wait on its earliest channel rather than poll them all.
+time64_t Intervalometer::nextWake() 
+{
+	time64_t now = Timebase::micros64();
+	
+	if (_phase != kPhaseIdle) return now + (long)(_phase_deadline - (unsigned long)now);
+	if (!active) return kNever;
+	if (program.isFinished()) return now;
+	
+	int64_t wake = (int64_t)(nextSlot() - leadTime()*1000UL);
+	if (_backend == kBackendTimer1) wake -= SHUTTER_ARM_LEAD*1000L;
+	if (wake < (int64_t)_settled_at) wake = _settled_at;	// Nothing to do until the slider has stopped
+	return wake > 0 ? (time64_t)wake : 0;
+}
+
+//--------------------------------------
+//	+ beginMove
+//	Shoot-move-shoot: with a frame done, move on to the next position,
+//	the path's for the next frame or move_steps along the slide.
+//	A move that won't be over and settled by the time the next frame
+//	has to start is counted; the frame then waits for it.
+void Intervalometer::beginMove() 
 {
-	previous_time = millis();			// Record the time that we start the exposure
+#ifdef USE_TIMER1_SHUTTER
+	if (!axis || motion_mode != kMotionShootMove) return;
+	
+	long steps[STEPPER_AXES] = { move_steps };
+	if (path && path->isActive()) {
+		for (uint8_t i = 0; i < axis->numAxes(); i++)
+			steps[i] = path->target(frame_count, i) - axis->position(i);
+	}
 	
-    digitalWrite(shutter_pin, HIGH);
-    delay(shutter_on);					// Should fuck with this, unsure what the proper value is.
-    digitalWrite(shutter_pin, LOW);
+	unsigned long travel = axis->moveTime(steps);
+	if (travel == 0) return;
 	
-    frame_count++;
+	unsigned long needed = travel + settle_time*1000UL;
+	if (!axis->moveBy(steps)) return;
+	
+	time64_t now	= Timebase::micros64();
+	_settled_at		= now + needed;
+	if ((int64_t)(now + needed) > (int64_t)(nextSlot() - leadTime()*1000UL)) motion_overruns++;
+#endif
+}
+
+bool Intervalometer::isSettled() 
+{
+#ifdef USE_TIMER1_SHUTTER
+	if (axis && axis->isMoving() && !axis->isCrawling()) return false;
+#endif
+	return Timebase::micros64() >= _settled_at;
+}
+
+void Intervalometer::triggerShutter() 
+{
+	if (_phase != kPhaseIdle) return;	// A frame already in flight will fire on its own
+	
+	_base_us	= pressTime()*1000UL;		// Manual shots don't step the ramp
+	_shot		= 0;
+	unsigned long now = Timebase::nowMicros();
+	if (_backend == kBackendTimer1) armFrame(now + leadTime()*1000UL);
+	else if (focus) beginFocus(now);		// Same focus lead as a timed frame
+	else pressShutter(now);
 }
 
 void Intervalometer::wakeAndFocus() 
+{
+	if (_phase == kPhaseIdle)
+		beginFocus(Timebase::nowMicros());
+}
+
+void Intervalometer::beginFocus(unsigned long when) 
 {
 	digitalWrite(focus_pin, HIGH);        // Wake the camera up/focus
-    delay(wakeup);                        // Wait for it...
-    digitalWrite(focus_pin, LOW);
+	_phase_deadline	= when + wakeup*1000UL;	// Planned from when, so the shutter still lands on its slot
+	_phase			= kPhaseFocus;
+}
+
+void Intervalometer::pressShutter(unsigned long when) 
+{
+	if (_shot == 0) {
+		previous_time = Timebase::millis64();	// Record the time that we start the exposure
+		frame_count++;
+	}
+	_press_us = shotExposure(_shot);
+	
+	digitalWrite(shutter_pin, HIGH);
+	shutter_log.record(when, Timebase::nowMicros());
+	_phase_deadline	= when + _press_us;	// Should fuck with this, unsure what the proper value is.
+	_phase			= kPhaseShutter;
+}
+
+//--------------------------------------
+//	+ planFrame
+//	Works out how long the coming frame holds the shutter. While a ramp
+//	runs it steps once per slot, and a frame whose exposure plus camera
+//	overhead would overrun the interval is refused rather than fired.
+//	A bracketed burst that won't fit is counted, but still fired.
+bool Intervalometer::planFrame() 
+{
+	if (ramp.isActive()) _base_us = ramp.next();
+	else if (ambient.getMode() == kAmbientExposure) {	// As long as the light wants, as long as the interval allows
+		unsigned long room = lapse_time - min(lapse_time, leadTime() + camera_overhead);
+		_base_us = ambient.next(1000UL, max(room, 1UL)*1000UL);
+	}
+	else _base_us = pressTime()*1000UL;
+	_shot		= 0;
+	
+	if (burstTime() + leadTime() + camera_overhead > lapse_time) {
+		if (ramp.isActive()) {
+			refused_frames++;
+			return false;
+		}
+		if (bracket_shots > 1) burst_overruns++;
+	}
+	return true;
+}
+
+//--------------------------------------
+//	+ shotExposure
+//	Exposure of one shot of the burst, us. The shots are spread evenly
+//	in EV either side of the frame's exposure, e.g. -2/0/+2. Capped at
+//	SHOT_MAX_US, about 33 minutes.
+unsigned long Intervalometer::shotExposure(uint8_t shot) 
+{
+	if (bracket_shots <= 1) return min(_base_us, SHOT_MAX_US);
+	
+	int thirds	= ((int)shot - (bracket_shots - 1)/2) * bracket_step;
+	int stops	= thirds >= 0 ? thirds/3 : -((2 - thirds)/3);	// Floor
 	
-    delay(wake_wait);
+	uint64_t exposure = ((uint64_t)_base_us * kThirdStops[thirds - stops*3]) >> 16;
+	exposure = stops >= 0 ? exposure << stops : exposure >> -stops;
+	
+	return exposure > SHOT_MAX_US ? SHOT_MAX_US : (unsigned long)exposure;
+}
+
+//--------------------------------------
+//	+ burstTime
+//	First shutter press to last release, ms. Seven long bulb shots run
+//	past what a micros() difference can hold, so not us.
+unsigned long Intervalometer::burstTime() 
+{
+	unsigned long total = 0;
+	for (uint8_t shot = 0; shot < bracket_shots; shot++)
+		total += shotExposure(shot)/1000;
+	return total + (bracket_shots - 1) * camera_overhead;
+}
+
+//--------------------------------------
+//	+ armFrame
+//	Hands a whole frame to Timer1 as one train of edges, with the
+//	shutter closing at the micros() time given and the focus pulse
+//	leadTime() ahead of it. From here on the ISR does the pin work.
+//	Slots are at most SHUTTER_ARM_LEAD away, well inside a micros() wrap.
+void Intervalometer::armFrame(unsigned long when) 
+{
+#ifdef USE_TIMER1_SHUTTER
+	unsigned long tick = ShutterTimer::ticksAt(when);
+	
+	if (focus) {
+		unsigned long focus_tick = tick - ShutterTimer::ticksFor(leadTime()*1000UL);
+		ShutterTimer::schedule(focus_pin, HIGH, focus_tick);
+		ShutterTimer::schedule(focus_pin, LOW, focus_tick + ShutterTimer::ticksFor(wakeup*1000UL));
+	}
+	
+	// The whole bracketed burst goes in as one train, camera_overhead apart
+	for (uint8_t shot = 0; shot < bracket_shots; shot++) {
+		unsigned long exposure = shotExposure(shot);
+		ShutterTimer::schedule(shutter_pin, HIGH, tick, &shutter_log);
+		ShutterTimer::schedule(shutter_pin, LOW, tick + ShutterTimer::ticksFor(exposure), &shutter_log);
+		tick += ShutterTimer::ticksFor(exposure + camera_overhead*1000UL);
+	}
+	
+	previous_time	= Timebase::millis64() + (long)(when - Timebase::nowMicros())/1000;	// When the exposure will start
+	_shot			= 0;
+	_phase_deadline	= when + shotExposure(0);	// Followed a shot at a time, a whole burst may not fit in a micros() difference
+	_phase			= kPhaseArmed;
+	
+	frame_count++;
+#endif
+}
+
+//--------------------------------------
+//	+ stepPhase
+//	Moves the focus/wait/shutter sequence along without blocking. Each
+//	phase is timed from the planned end of the previous one rather than
+//	from "now", so a late loop() doesn't push the following edges back.
+void Intervalometer::stepPhase() 
+{
+	if (_phase == kPhaseIdle || !Timebase::reachedMicros(_phase_deadline))
+		return;
+	
+	switch (_phase) {
+		case kPhaseFocus:
+			digitalWrite(focus_pin, LOW);
+			_phase_deadline	+= wake_wait*1000UL;
+			_phase			= kPhaseWakeWait;
+			break;
+			
+		case kPhaseWakeWait:
+		case kPhaseGap:
+			pressShutter(_phase_deadline);
+			break;
+			
+		case kPhaseShutter:
+			digitalWrite(shutter_pin, LOW);
+			shutter_log.record(_phase_deadline, Timebase::nowMicros());
+			if (++_shot < bracket_shots) {	// More of the burst to go
+				_phase_deadline	+= camera_overhead*1000UL;
+				_phase			= kPhaseGap;
+				break;
+			}
+			// Fall through, that was the last shot
+		case kPhaseArmed:					// Timer1 writes the pins, this only keeps up with it
+			if (_phase == kPhaseArmed && ++_shot < bracket_shots) {
+				_phase_deadline	+= camera_overhead*1000UL + shotExposure(_shot);
+				break;
+			}
+			_phase = kPhaseIdle;
+			
+			if (frame_limit != -1 && frame_count >= frame_limit)
+				stop();
+			if (active) beginMove();
+			break;
+			
+		default:
+			break;
+	}
 }
 
 void Intervalometer::start() 
@@ -128,17 +540,176 @@ void Intervalometer::start()
 	previous_time	= 0;
 	active			= true;
 	frame_count		= 0;
+	missed_frames	= 0;
+	late_frames		= 0;
+	worst_late		= 0;
+	motion_overruns	= 0;
+	_settled_at		= 0;
+	shutter_log.reset();
+	
+	// The delay is just a later first slot. Even without one, the first slot is far enough
+	// off for its focus pulse, and for Timer1 to be handed it, so it isn't late from the start.
+	_start_micros	= Timebase::micros64() + (start_delay + leadTime())*1000ULL;
+	if (_backend == kBackendTimer1) _start_micros += SHUTTER_ARM_LEAD*1000UL;
+	_frame_index	= 0;
+	
+	if (program.isActive()) lapse_time = program.first();
+	
+#ifdef USE_TIMER1_SHUTTER
+	if (axis && motion_mode == kMotionContinuous && move_steps != 0)
+		axis->crawl(move_steps > 0 ? 1 : -1, crawl_period*1000UL);
+	if (path && path->isActive()) beginMove();	// Out to the first frame's place during the delay
+#endif
+}
+
+//--------------------------------------
+//	+ delayRemaining
+//	Milliseconds until the first frame of a session that's counting
+//	down its start delay, 0 once it's under way or stopped.
+unsigned long Intervalometer::delayRemaining() 
+{
+	if (!active || _frame_index > 0) return 0;
+	
+	time64_t now = Timebase::micros64();
+	return _start_micros > now ? (unsigned long)((_start_micros - now) / 1000) : 0;
 }
 
 void Intervalometer::stop() 
 {
 	active = false;
+	
+#ifdef USE_TIMER1_SHUTTER
+	if (_phase == kPhaseArmed) {		// Pull back a frame that's been handed to Timer1
+		ShutterTimer::cancel(focus_pin);
+		ShutterTimer::cancel(shutter_pin);
+		_phase = kPhaseIdle;
+	}
+	if (axis && axis->isCrawling()) axis->stop();
+#endif
 }
 
 void Intervalometer::setInterval(float seconds) 
 {
-	lapse_time = (int)(seconds*1000.0f);
+	if (!program.isActive()) setLapse(Timebase::toMillis(seconds));
 }
 
+//--------------------------------------
+//	+ setLapse
+//	Changes the gap to the next slot. The grid is re-based on the last
+//	slot taken, so frames already taken stay where they were.
+void Intervalometer::setLapse(unsigned long msecs) 
+{
+	if (_frame_index > 0) {				// Mid-session, so keep the last slot and carry on from there
+		_start_micros	+= (time64_t)(_frame_index - 1) * lapse_time * 1000UL;
+		_frame_index	= 1;
+	}
+	lapse_time = msecs;
+}
+
+//--------------------------------------
+//	+ setProgram
+//	Runs the built in (flash) or saved (EEPROM) interval program, or
+//	goes back to the plain interval. The program restarts with the session.
+bool Intervalometer::setProgram(eProgramSource source) 
+{
+	bool loaded = false;
+	switch (source) {
+		case kProgramFlash:
+			loaded = program.loadFlash(kDefaultProgram, sizeof(kDefaultProgram) / sizeof(ProgramSegment));
+			break;
+			
+		case kProgramEEPROM:
+			loaded = program.loadEEPROM(PROGRAM_EEPROM_ADDRESS);
+			break;
+			
+		default:
+			break;
+	}
+	if (!loaded) program.stop();
+	return loaded;
+}
+
+//--------------------------------------
+//	+ saveProgram
+//	Keeps the program that's loaded in EEPROM, where the saved program
+//	is read from. False if there's none loaded.
+bool Intervalometer::saveProgram() 
+{
+	return program.saveEEPROM(PROGRAM_EEPROM_ADDRESS);
+}
+
+//--------------------------------------
+//	+ setExposure
+//	Bulb exposure length. Takes effect from the next frame, one that is
+//	already open keeps the release it was planned with.
+void Intervalometer::setExposure(unsigned long msecs) 
+{
+	exposure_time = msecs;
+}
+
+//--------------------------------------
+//	+ setBulb
+//	A ramp, auto exposure or a bracket times the exposure itself, so
+//	while any of them is on the shutter stays in bulb.
+void Intervalometer::setBulb(bool on) 
+{
+	bulb = on || ramp.isActive() || ambient.getMode() == kAmbientExposure || bracket_shots > 1;
+}
+
+//--------------------------------------
+//	+ startRamp
+//	Ramps the bulb exposure from exposure_time to end_msecs over the
+//	frames that fit in duration_secs at the current interval.
+void Intervalometer::startRamp(unsigned long end_msecs, unsigned long duration_secs, eRampCurve curve) 
+{
+	unsigned long frames = lapse_time ? (duration_secs * 1000ULL) / lapse_time : 0;
+	
+	ramp.setup(exposure_time*1000UL, end_msecs*1000UL, frames, curve);
+	if (ramp.isActive()) bulb = true;
+	refused_frames = 0;
+}
+
+//--------------------------------------
+//	+ startAmbient
+//	Follows the light from the current exposure (bulb) or interval.
+//	A ramp or program already running takes precedence over it.
+void Intervalometer::startAmbient(eAmbientMode mode) 
+{
+	if (mode == kAmbientExposure) {
+		ambient.start(mode, exposure_time*1000UL);
+		if (ambient.isActive()) bulb = true;
+	} else ambient.start(mode, lapse_time);
+}
+
+//--------------------------------------
+//	+ setBracket
+//	Bracketing fires bulb shots, so turning it on switches to bulb.
+//	Refused, false, while a frame is under way.
+bool Intervalometer::setBracket(uint8_t shots, uint8_t step) 
+{
+	if (_phase != kPhaseIdle) return false;	// Not mid-burst
+	
+	bracket_shots	= constrain(shots | 1, 1, BRACKET_MAX);
+	bracket_step	= step;
+	burst_overruns	= 0;
+	if (bracket_shots > 1) bulb = true;
+	return true;
+}
+
+//--------------------------------------
+//	+ setBackend
+//	Timer1 gives edges that don't care what loop() is doing. Without
+//	USE_TIMER1_SHUTTER, or to free Timer1, the pins are polled from loop().
+void Intervalometer::setBackend(eShutterBackend new_backend) 
+{
+	if (_phase != kPhaseIdle) return;	// Not mid-frame
+	
+#ifdef USE_TIMER1_SHUTTER
+	if (new_backend == kBackendTimer1) ShutterTimer::begin();
+	_backend = new_backend;
+#else
+	_backend = kBackendPolling;
+#endif
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+/*
+ *  IntervalometerRig.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Several cameras from one scheduler. Each channel is an Intervalometer
+ *  with its own pins, interval and exposure; the rig keeps them in a
+ *  min-heap ordered by when each next needs attention.
+ *
+ *	Nothing due costs one compare against the top of the heap. Edges
+ *	from different channels meet only in ShutterTimer's queue, which
+ *	orders them by tick.
+ *
+ */
+
+#ifndef IntervalometerRig_h
+#define IntervalometerRig_h
+
+#include "WProgram.h"
+#include "Timebase.h"
+#include "Intervalometer.h"
+
+#define RIG_MAX_CHANNELS	4
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * IntervalometerRig
+ * *  ---------------------------------------------------------
+ * *	Call refresh() after changing a channel from outside (menu,
+ * *	manual trigger) so its place in the heap is worked out again.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class IntervalometerRig
+{
+	public:
+		IntervalometerRig();
+
+		bool addChannel(Intervalometer *channel);
+		Intervalometer* channel(uint8_t index) { return index < _num_channels ? _channels[index] : _channels[0]; }
+		uint8_t numChannels() { return _num_channels; }
+
+		void loop();
+		void refresh() { _dirty = true; }
+		time64_t nextWake() { return _num_channels ? _wake[_heap[0]] : kNever; }
+
+		void start();
+		void stop();
+		bool isBusy();						// Any channel partway through a frame
+
+	private:
+		Intervalometer	*_channels[RIG_MAX_CHANNELS];
+		time64_t		_wake[RIG_MAX_CHANNELS];		// By channel
+		uint8_t			_heap[RIG_MAX_CHANNELS];		// Channel numbers, earliest wake on top
+		uint8_t			_num_channels;
+		bool			_dirty;
+
+		void rebuild();
+		void siftDown(uint8_t pos);
+		bool earlier(uint8_t a, uint8_t b) { return _wake[_heap[a]] < _wake[_heap[b]]; }
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * IntervalometerRig Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+IntervalometerRig::IntervalometerRig()
+{
+	_num_channels	= 0;
+	_dirty			= false;
+}
+
+bool IntervalometerRig::addChannel(Intervalometer *channel)
+{
+	if (_num_channels >= RIG_MAX_CHANNELS) return false;
+
+	_channels[_num_channels]	= channel;
+	_heap[_num_channels]		= _num_channels;
+	_num_channels++;
+	_dirty = true;
+	return true;
+}
+
+//--------------------------------------
+//	+ loop
+//	Services channels in wake order until the top of the heap is in
+//	the future. A serviced channel gets its new wake time and sinks.
+void IntervalometerRig::loop()
+{
+	if (_num_channels == 0) return;
+	if (_dirty) rebuild();
+
+	time64_t now = Timebase::micros64();
+	for (uint8_t n = 0; n < _num_channels && _wake[_heap[0]] <= now; n++) {
+		Intervalometer *channel = _channels[_heap[0]];
+		channel->loop();
+		_wake[_heap[0]] = channel->nextWake();
+		siftDown(0);
+	}
+}
+
+void IntervalometerRig::start()
+{
+	for (uint8_t i = 0; i < _num_channels; i++) _channels[i]->start();
+	_dirty = true;
+}
+
+void IntervalometerRig::stop()
+{
+	for (uint8_t i = 0; i < _num_channels; i++) _channels[i]->stop();
+	_dirty = true;
+}
+
+bool IntervalometerRig::isBusy()
+{
+	for (uint8_t i = 0; i < _num_channels; i++)
+		if (_channels[i]->isBusy()) return true;
+	return false;
+}
+
+void IntervalometerRig::rebuild()
+{
+	for (uint8_t i = 0; i < _num_channels; i++)
+		_wake[i] = _channels[i]->nextWake();
+	for (int8_t pos = _num_channels/2 - 1; pos >= 0; pos--)
+		siftDown(pos);
+	_dirty = false;
+}
+
+void IntervalometerRig::siftDown(uint8_t pos)
+{
+	for (;;) {
+		uint8_t child = 2*pos + 1;
+		if (child >= _num_channels) return;
+		if (child + 1 < _num_channels && earlier(child + 1, child)) child++;
+		if (!earlier(child, pos)) return;
+
+		uint8_t swap	= _heap[pos];
+		_heap[pos]		= _heap[child];
+		_heap[child]	= swap;
+		pos = child;
+	}
+}
+
+#endif
@@ -14,10 +14,14 @@
 
 #include <WString.h>
 #include "WProgram.h"
+#include <avr/pgmspace.h>
 #include "intervalomedio.h"
+#include "Timebase.h"
 
 #include "Event.h"
 
+#define LCD_WIDTH		16		// Characters on a line
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * * * LCDMenuParameter
  * *  ---------------------------------------------------------
@@ -62,9 +66,8 @@ class LCDMenuParameter {
 		
 		virtual char* getDisplayValue()
 		{
-			String output = String((int) _value);
-			char buf[24];
-			output.toCharArray(buf, 24);
+			static char buf[12];			// Long, exposures run past an int
+			ltoa((long)_value, buf, 10);
 			return buf;
 		}
 		
@@ -72,13 +75,14 @@ class LCDMenuParameter {
 		
 		virtual void setValue(float new_value)
 		{
+			new_value = constrain(new_value, _floor, _ceiling);	// A held key's big steps overshoot, the callback gets what's shown
 			if (_value != new_value) {
-				_value = constrain(new_value, _floor, _ceiling);
+				_value = new_value;
 				if (_setValueCallback) { // If a callback is set for this value, create an event and call it.
 					Event event;
 					event.source	= _id;
-					event.time		= millis();
-					event.value		= new_value;
+					event.time		= Timebase::now();
+					event.value		= _value;
 					event.object	= this;
 					_setValueCallback(event);
 				}
@@ -86,11 +90,22 @@ class LCDMenuParameter {
 			}
 		}
 		
-		virtual void incValue(int steps)
+		//--------------------------------------
+		//	+ incValue
+		//	multiplier comes from a held key. It's cut back by tens
+		//	until one step is no more than a tenth of the range.
+		virtual void incValue(int steps, long multiplier = 1)
 		{
-			setValue(_value + (_inc*steps));
+			while (multiplier > 1 && _inc*multiplier*10 > _ceiling - _floor) multiplier /= 10;
+			setValue(_value + (_inc*steps*multiplier));
 		}
 		
+		//--------------------------------------
+		//	+ showValue
+		//	Changes what's shown without calling back, for when the
+		//	setting behind it was changed by something other than the menu.
+		virtual void showValue(float new_value) { _value = constrain(new_value, _floor, _ceiling); }
+		
 		virtual void enterKey()
 		{
 			// Enter key was pressed, do we care?
@@ -102,6 +117,7 @@ class LCDMenuParameter {
 		}
 		
 		virtual bool isFloatValue() { return _display_float; }
+		virtual bool isLive() { return false; }		// Value changes on its own and wants redrawing
 };
 
 class LCDMenuButton :
@@ -110,36 +126,30 @@ public LCDMenuParameter {
 		int						_num_states;
 		int						_state;
 		
-		char					*_state_values[MAX_STATES];
-		char					_states_copy[MAX_STATES][15];
+		PGM_P					_states;			// Labels packed end to end in PROGMEM, "Off\0On". Not copied.
 		
 	public:
 		LCDMenuButton() { }
 		
-		LCDMenuButton(char in_name[], int id_tag, char *state_values[], int num_states=1, int init_state = 0, SetValueCallback setValueCallback = NULL) 
+		LCDMenuButton(char in_name[], int id_tag, PGM_P states, int num_states=1, int init_state = 0, SetValueCallback setValueCallback = NULL) 
 		{
 			init(in_name, id_tag, setValueCallback);
-// 			Serial.print(state_values);
 			_num_states				= num_states;
 			_state					= init_state;
-			
-			
-			for (int n = 0; n < num_states; n++) {
-				strcpy(_states_copy[n], state_values[n]);
-//				_state_values[n]	= state_values[n];
-			}
+			_states					= states;
 		}
 		
+		//--------------------------------------
+		//	+ getDisplayValue
+		//	The labels stay in flash, only the one being drawn is copied out.
 		char * getDisplayValue()
 		{
-//			char buf[24];
-//			_state_values.toCharArray(buf, 24);
-//			cout << _state_values;
-			
-			//Serial << buf << "State: " << _state;
-			//Serial.println(_state_values);
-			return _states_copy[_state];
-		//	return _state_values[_state];
+			static char buf[LCD_WIDTH + 1];
+			PGM_P label = _states;
+			for (int n = 0; n < _state; n++) label += strlen_P(label) + 1;
+			strncpy_P(buf, label, LCD_WIDTH);
+			buf[LCD_WIDTH] = '\0';
+			return buf;
 		}
 		
 		bool validState(int state) {
@@ -153,7 +163,7 @@ public LCDMenuParameter {
 				if (_setValueCallback) { // If a callback is set for this value, create an event and call it.
 					Event event;
 					event.source	= _id;
-					event.time		= millis();
+					event.time		= Timebase::now();
 					event.state		= _state;
 //					event.object	= this;
 					_setValueCallback(event);
@@ -161,11 +171,13 @@ public LCDMenuParameter {
 			} else if (!validState(_state)) _state = 0;
 		}
 		
+		void showValue(float new_value) { if (validState((int)new_value)) _state = (int)new_value; }
+		
 		void enterKey() {
 			setValue(_state);
 		}
 		
-		void incValue(int steps)
+		void incValue(int steps, long multiplier = 1)		// One state at a time, however long the key's held
 		{
 			if (_state + steps >= _num_states) incValue(_state + steps - _num_states);
 			else if (_state+steps < 0) setValue(_num_states - 1 - (_state + steps));
@@ -175,6 +187,44 @@ public LCDMenuParameter {
 		bool isFloatValue() { return false; }
 };
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * LCDMenuReadout
+ * *  ---------------------------------------------------------
+ * *	A read-only item. Asks a callback for its value each time
+ * *	it is drawn, for showing stats from other components.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+typedef long (*GetValueCallback)();
+
+class LCDMenuReadout :
+public LCDMenuParameter {
+	protected:
+		GetValueCallback		_getValueCallback;
+		
+	public:
+		LCDMenuReadout(char in_name[], GetValueCallback getValueCallback) 
+		{
+			init(in_name, -1, NULL);
+			_display_float			= false;
+			_getValueCallback		= getValueCallback;
+		}
+		
+		float getValue() { return (float)_getValueCallback(); }
+		
+		char* getDisplayValue()
+		{
+			static char buf[12];
+			ltoa(_getValueCallback(), buf, 10);
+			return buf;
+		}
+		
+		void setValue(float new_value) { }		// Read only
+		void showValue(float new_value) { }
+		void incValue(int steps, long multiplier = 1) { }
+		bool isLive() { return true; }
+};
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * * * LCDMenuSection
  * *  ---------------------------------------------------------
@@ -186,7 +236,7 @@ public LCDMenuParameter {
 class LCDMenuSection {
 	private:
 		//LCDMenuItem[]		submenus;
-		LCDMenuParameter	*_params[8];			// TODO: make this a linked list.
+		LCDMenuParameter	*_params[MAX_PARAMS];	// TODO: make this a linked list.
 		int					_num_params;
 		int					_index;				// Currently selected param/submenu
 		
@@ -207,13 +257,17 @@ class LCDMenuSection {
 		
 		void addParameter(LCDMenuParameter *new_param)
 		{
-			if (_num_params < 8) {
+			if (_num_params < MAX_PARAMS) {
 				_params[_num_params++] = new_param;
 			}	// TODO: Should fail gracefully... or create a new array!
 		}
 		
-		void nextItem() { if (_index < _num_params-1) _index++; else _index = 0; }
-		void prevItem() { if (_index > 0) _index--; else _index = _num_params-1; }
+		// Both return true when they wrap around the end of the section.
+		bool nextItem() { if (_index < _num_params-1) { _index++; return false; } _index = 0; return true; }
+		bool prevItem() { if (_index > 0) { _index--; return false; } _index = _num_params-1; return true; }
+		
+		void firstItem() { _index = 0; }
+		void lastItem() { _index = _num_params-1; }
 };
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -231,18 +285,23 @@ class LCDMenu {
 		bool				_dirt[2];
 		int					_backlight_level;
 		bool				_is_asleep;
-		int					_sleep_timeout;				// Milliseconds of inactivity before the display is put to sleep
+		unsigned long		_sleep_timeout;				// Milliseconds of inactivity before the display is put to sleep
 		unsigned long		_last_activity_time;		// Time of last activity (redraw)
 		LCDMenuSection		*_root;
 		LCDMenuSection		*_cur_section;
+		LCDMenuSection		*_sections[MAX_SECTIONS];	// Stepped through in order, items wrap into the next
+		int					_num_sections;
+		int					_section_index;
 		
 	public:
 		LCDMenu()
 		{			
 			_root				= NULL;
 			_cur_section		= NULL;
+			_num_sections		= 0;
+			_section_index		= 0;
 			_is_asleep			= false;
-			_sleep_timeout		= 30*1000;
+			_sleep_timeout		= 30*1000UL;
 			_backlight_level	= 150;
 			
 			clearLCD();
@@ -276,34 +335,70 @@ class LCDMenu {
 					}
 					_dirt[1] = false;
 				}
-			} else if (!_is_asleep && millis() - _last_activity_time > _sleep_timeout)
-				sleep();	// Put the screen to sleep after a bit of inactivity
+			}
 		}
 		
+		//--------------------------------------
+		//	+ refreshLive
+		//	Marks the value row for redraw if it's showing a live readout.
+		//	Doesn't count as activity, so the screen can still go to sleep.
+		void refreshLive()
+		{
+			if (!_is_asleep && _cur_section->getCurrentParameter()->isLive()) {
+				_dirty		= true;
+				_dirt[1]	= true;
+			}
+		}
+		
+		// When the screen should go to sleep after a bit of inactivity.
+		unsigned long sleepDeadline() { return _last_activity_time + _sleep_timeout; }
+		bool isAsleep() { return _is_asleep; }
+		
 		void nextItem() 
 		{
-			_cur_section->nextItem();
+			if (_cur_section->nextItem() && _num_sections > 1) {
+				selectSection(_section_index + 1 < _num_sections ? _section_index + 1 : 0);
+				_cur_section->firstItem();
+			}
 			setDirty(true);
 		}
 		
 		void prevItem() 
 		{
-			_cur_section->prevItem();
+			if (_cur_section->prevItem() && _num_sections > 1) {
+				selectSection(_section_index > 0 ? _section_index - 1 : _num_sections - 1);
+				_cur_section->lastItem();
+			}
 			setDirty(true);
 		}
 		
-		void incCurrentParam(int inc) 
+		// Straight to the top of the next or previous section.
+		void nextSection()
+		{
+			selectSection(_section_index + 1 < _num_sections ? _section_index + 1 : 0);
+			_cur_section->firstItem();
+		}
+		
+		void prevSection()
+		{
+			selectSection(_section_index > 0 ? _section_index - 1 : _num_sections - 1);
+			_cur_section->firstItem();
+		}
+		
+		void incCurrentParam(int inc, long multiplier = 1) 
 		{
-			_cur_section->getCurrentParameter()->incValue(inc);
+			_cur_section->getCurrentParameter()->incValue(inc, multiplier);
 			setDirty(true, 2);
 		}
 		
 		void addSection(LCDMenuSection *section, LCDMenuSection *parent = NULL) 
 		{
-			// Add a submenu or group of parameters... LCDMenu only works with one section currently.
-			_cur_section = section;		// Set this to the active section 
+			// Add a group of parameters. Sections sit side by side, parent is still unused.
+			if (_num_sections >= MAX_SECTIONS) return;
+			_sections[_num_sections] = section;
+			selectSection(_num_sections++);	// Set this to the active section, for filling in
 			if (_root == NULL)
-				_root = section;		// Temp. Should only be for the first item.
+				_root = section;
 			
 			setDirty(true);
 		}
@@ -313,6 +408,15 @@ class LCDMenu {
 		}
 		
 		LCDMenuSection * getCurrentSection() { return _cur_section; }
+		int getSectionIndex() { return _section_index; }
+		
+		void selectSection(int index)
+		{
+			if (index < 0 || index >= _num_sections) return;
+			_section_index	= index;
+			_cur_section	= _sections[index];
+			setDirty(true);
+		}
 		
 		void setDirty(bool is_dirty, int row = 0) 
 		{			
@@ -342,7 +446,7 @@ class LCDMenu {
 				
 				_is_asleep = false;
 			}
-			_last_activity_time = millis();
+			_last_activity_time = Timebase::now();
 		}
 		
 		void sleep()
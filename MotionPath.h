@@ -0,0 +1,97 @@
+/*
+ *  MotionPath.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Keyframed moves for the slider. Each key pins every motor's position
+ *  to a frame number; in between, the position for each frame is a
+ *  straight line from one key to the next. Before the first key and
+ *  after the last the rig holds still.
+ *
+ *	Keys are set from wherever the motors have been jogged to, so the
+ *	path is laid down by walking the rig through it.
+ *
+ */
+
+#ifndef MotionPath_h
+#define MotionPath_h
+
+#include "WProgram.h"
+#include "StepperAxis.h"
+
+#define PATH_MAX_KEYS		8
+
+struct PathKey
+{
+	unsigned int	frame;
+	long			position[STEPPER_AXES];
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * MotionPath
+ * *  ---------------------------------------------------------
+ * *	Keys are kept sorted by frame. target() is integer only, a
+ * *	multiply and a divide per motor, once per frame.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class MotionPath
+{
+	public:
+		MotionPath() { clear(); }
+
+		bool setKey(unsigned int frame, const long *position);
+		void clear() { _count = 0; }
+
+		bool isActive() { return _count > 0; }
+		uint8_t keys() { return _count; }
+		long target(unsigned int frame, uint8_t axis);
+
+	private:
+		PathKey		_keys[PATH_MAX_KEYS];
+		uint8_t		_count;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * MotionPath Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+//--------------------------------------
+//	+ setKey
+//	Adds a key, or moves the one already at that frame. False when
+//	the path is full.
+bool MotionPath::setKey(unsigned int frame, const long *position)
+{
+	uint8_t i = 0;
+	while (i < _count && _keys[i].frame < frame) i++;
+
+	if (i == _count || _keys[i].frame != frame) {
+		if (_count >= PATH_MAX_KEYS) return false;
+		for (uint8_t j = _count; j > i; j--) _keys[j] = _keys[j - 1];
+		_count++;
+	}
+
+	_keys[i].frame = frame;
+	for (uint8_t axis = 0; axis < STEPPER_AXES; axis++) _keys[i].position[axis] = position[axis];
+	return true;
+}
+
+//--------------------------------------
+//	+ target
+//	Where a motor should be for a frame.
+long MotionPath::target(unsigned int frame, uint8_t axis)
+{
+	if (_count == 0 || axis >= STEPPER_AXES) return 0;
+	if (frame <= _keys[0].frame) return _keys[0].position[axis];
+
+	uint8_t i = 1;
+	while (i < _count && _keys[i].frame < frame) i++;
+	if (i == _count) return _keys[_count - 1].position[axis];
+
+	PathKey *from	= &_keys[i - 1];
+	PathKey *to		= &_keys[i];
+	long span		= to->position[axis] - from->position[axis];
+	return from->position[axis] + (long)(((int64_t)span * (frame - from->frame)) / (to->frame - from->frame));
+}
+
+#endif
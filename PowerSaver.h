@@ -0,0 +1,250 @@
+/*
+ *  PowerSaver.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Sleeps the chip between scheduled tasks. Short gaps are spent in
+ *  idle mode, where Timer0 keeps millis() going and any interrupt wakes
+ *  us. Long gaps with nothing in flight are spent powered down, woken
+ *  by the watchdog, and the time slept is added back onto millis() and
+ *  micros() so the schedule carries on as if the clock never stopped.
+ *
+ *	Timer2's asynchronous mode would be the better clock to sleep on,
+ *	but it wants a 32 kHz crystal the usual boards don't have. The
+ *	watchdog's own oscillator is only good to a few percent, so it's
+ *	measured against Timer0 every so often, and the last stretch before
+ *	a deadline is always spent in idle.
+ *
+ */
+
+#ifndef PowerSaver_h
+#define PowerSaver_h
+
+#include "WProgram.h"
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include "Timebase.h"
+
+#define POWER_WAKE_MARGIN		3000	// Usecs of a gap left for waking up and watchdog error
+#define POWER_WAKEUP_US			1024	// Oscillator start-up after power-down, 16K clocks
+#define POWER_CALIBRATE_EVERY	8		// Power-downs between watchdog measurements
+#define POWER_LONGEST			9		// Longest watchdog period, 16 ms << 9 = 8 s
+
+#define POWER_ACTIVE_UA			9000	// Supply current awake at 16 MHz, 5 V. Chip only, not the board or LCD.
+#define POWER_IDLE_UA			3500	// In idle mode
+#define POWER_DOWN_UA			30		// Powered down with the watchdog and brown-out detector on
+
+// From wiring.c. Timer0 stops when powered down, these are moved on by hand.
+extern "C" volatile unsigned long timer0_millis;
+extern "C" volatile unsigned long timer0_overflow_count;
+
+#define kMicrosPerOverflow		(64UL * 256 / clockCyclesPerMicrosecond())
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * PowerSaver
+ * *  ---------------------------------------------------------
+ * *	Static, there is only the one watchdog. Something woken by
+ * *	an interrupt other than the watchdog can't tell how long it
+ * *	slept; those are counted in early_wakes and credited nothing.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class PowerSaver
+{
+	public:
+		static void begin();
+		static void sleep(unsigned long msecs, bool deep);
+
+		static unsigned long energyPer1000(unsigned long frames, bool sleeping = true);	// mAh per 1000 frames
+		static unsigned long watchdogMicros() { return _wdt_us; }
+
+		static time64_t			idle_us;		// Time spent in idle mode
+		static time64_t			down_us;		// Time spent powered down
+		static unsigned long	early_wakes;
+
+		static volatile bool	_wdt_fired;
+
+	private:
+		static time64_t			_started;
+		static unsigned long	_wdt_us;		// Measured length of the shortest watchdog period
+		static uint8_t			_until_calibrate;
+		static unsigned int		_millis_carry;	// Usecs not yet added onto the Timer0 counts
+		static unsigned int		_overflow_carry;
+
+		static void calibrate();
+		static void powerDown(uint8_t period);
+		static void idle();
+		static void addTime(unsigned long usecs);
+		static void watchdogOn(uint8_t period);
+		static void watchdogOff();
+};
+
+time64_t				PowerSaver::idle_us			= 0;
+time64_t				PowerSaver::down_us			= 0;
+unsigned long			PowerSaver::early_wakes		= 0;
+volatile bool			PowerSaver::_wdt_fired		= false;
+time64_t				PowerSaver::_started		= 0;
+unsigned long			PowerSaver::_wdt_us			= 16000;
+uint8_t					PowerSaver::_until_calibrate	= 0;
+unsigned int			PowerSaver::_millis_carry		= 0;
+unsigned int			PowerSaver::_overflow_carry		= 0;
+
+ISR(WDT_vect)
+{
+	PowerSaver::_wdt_fired = true;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * PowerSaver Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void PowerSaver::begin()
+{
+	_started = Timebase::micros64();
+	_until_calibrate = 0;
+}
+
+//--------------------------------------
+//	+ sleep
+//	Call with the time until the next deadline. Powers down for the
+//	longest watchdog period that fits if deep is allowed, otherwise
+//	idles until the next interrupt (a millisecond at most, Timer0).
+//	Returns after one stretch either way; call again from loop().
+void PowerSaver::sleep(unsigned long msecs, bool deep)
+{
+	if (msecs == 0) return;
+
+	if (deep) {
+		if (_until_calibrate == 0) {
+			calibrate();
+			return;							// That took a while, let the scheduler look again
+		}
+
+		unsigned long usable = msecs*1000UL;
+		if (usable > POWER_WAKE_MARGIN + _wdt_us) {
+			usable -= POWER_WAKE_MARGIN;
+			uint8_t period = 0;
+			while (period < POWER_LONGEST && (_wdt_us << (period + 1)) <= usable) period++;
+			powerDown(period);
+			return;
+		}
+	}
+	idle();
+}
+
+//--------------------------------------
+//	+ energyPer1000
+//	The energy model: time awake, idle and powered down weighted by
+//	the supply current in each. With sleeping false, what it would
+//	have cost awake the whole time, for comparison.
+unsigned long PowerSaver::energyPer1000(unsigned long frames, bool sleeping)
+{
+	if (frames == 0) return 0;
+
+	time64_t total	= Timebase::micros64() - _started;
+	float ua_us;
+	if (sleeping) {
+		time64_t active = total - idle_us - down_us;
+		ua_us = (float)active*POWER_ACTIVE_UA + (float)idle_us*POWER_IDLE_UA + (float)down_us*POWER_DOWN_UA;
+	} else ua_us = (float)total*POWER_ACTIVE_UA;
+
+	// uA*us to mAh is / 3.6e12, per 1000 frames is * 1000.
+	return (unsigned long)(ua_us / 3.6e9f / frames + 0.5f);
+}
+
+//--------------------------------------
+//	+ calibrate
+//	Times the shortest watchdog period against micros(), idling so
+//	Timer0 keeps counting. Longer periods are exact multiples of it.
+void PowerSaver::calibrate()
+{
+	watchdogOn(0);
+	unsigned long start = Timebase::nowMicros();
+	while (!_wdt_fired) idle();
+	_wdt_us = Timebase::elapsed(start, Timebase::nowMicros());
+	watchdogOff();
+
+	_until_calibrate = POWER_CALIBRATE_EVERY;
+}
+
+void PowerSaver::powerDown(uint8_t period)
+{
+	unsigned char adc = ADCSRA;
+	ADCSRA &= ~_BV(ADEN);					// The ADC draws more than everything else put together
+	watchdogOn(period);
+
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	cli();
+	sleep_enable();
+	if (!_wdt_fired) {
+		sei();								// Takes effect after the next instruction, so the wake can't be missed
+		sleep_cpu();
+	} else sei();
+	sleep_disable();
+
+	bool timed_out = _wdt_fired;
+	watchdogOff();
+	ADCSRA = adc;
+
+	if (timed_out) {
+		unsigned long slept = (_wdt_us << period) + POWER_WAKEUP_US;
+		addTime(slept);
+		down_us += slept;
+	} else early_wakes++;
+
+	if (_until_calibrate) _until_calibrate--;
+}
+
+void PowerSaver::idle()
+{
+	unsigned long start = Timebase::nowMicros();
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_mode();
+	idle_us += Timebase::elapsed(start, Timebase::nowMicros());
+}
+
+//--------------------------------------
+//	+ addTime
+//	Moves millis() and micros() on by a stretch Timer0 slept through.
+//	They're kept separately in wiring.c, so each gets its own carry.
+void PowerSaver::addTime(unsigned long usecs)
+{
+	unsigned long ms	= (usecs + _millis_carry) / 1000;
+	_millis_carry		= (usecs + _millis_carry) % 1000;
+	unsigned long ovf	= (usecs + _overflow_carry) / kMicrosPerOverflow;
+	_overflow_carry		= (usecs + _overflow_carry) % kMicrosPerOverflow;
+
+	uint8_t sreg = SREG;
+	cli();
+	timer0_millis			+= ms;
+	timer0_overflow_count	+= ovf;
+	SREG = sreg;
+}
+
+void PowerSaver::watchdogOn(uint8_t period)
+{
+	uint8_t prescale = (period & 7) | ((period & 8) ? _BV(WDP3) : 0);
+
+	uint8_t sreg = SREG;
+	cli();
+	_wdt_fired = false;
+	wdt_reset();
+	MCUSR	&= ~_BV(WDRF);
+	WDTCSR	= _BV(WDCE) | _BV(WDE);			// Timed sequence, the next write has to follow within 4 clocks
+	WDTCSR	= _BV(WDIE) | prescale;			// Interrupt only, no reset
+	SREG = sreg;
+}
+
+void PowerSaver::watchdogOff()
+{
+	uint8_t sreg = SREG;
+	cli();
+	wdt_reset();
+	MCUSR	&= ~_BV(WDRF);
+	WDTCSR	= _BV(WDCE) | _BV(WDE);
+	WDTCSR	= 0;
+	SREG = sreg;
+}
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ *  Scheduler.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  A small cooperative scheduler. Components register tasks with a
+ *  deadline in millis() and loop() only runs what is due, instead of
+ *  polling every component on every pass.
+ *
+ *	Tasks live on a timer wheel of one-millisecond slots. A pass where
+ *	the clock hasn't moved costs a compare; otherwise it looks at the
+ *	slots the clock moved through. Deadlines further out than the wheel
+ *	just get skipped over each time round.
+ *
+ */
+
+#ifndef Scheduler_h
+#define Scheduler_h
+
+#include "WProgram.h"
+#include "Timebase.h"
+
+#define SCHEDULER_SLOTS		32		// Wheel size in milliseconds, must be a power of two
+
+typedef void (*TaskCallback)();
+
+struct Task
+{
+	TaskCallback		callback;
+	unsigned long		deadline;		// millis() at which to run
+	unsigned long		period;			// Re-run this often, 0 for one-shot
+	Task				*next;
+	bool				queued;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * Scheduler
+ * *  ---------------------------------------------------------
+ * *	A task may reschedule or cancel itself, or any other task,
+ * *	from its callback. A periodic one that does neither is put
+ * *	back one period on.
+ * *	Scheduling for a time already past runs the task on the next
+ * *	pass.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class Scheduler
+{
+	public:
+		Scheduler();
+
+		void add(Task *task, TaskCallback callback, unsigned long period = 0);
+		void at(Task *task, unsigned long deadline);
+		void after(Task *task, unsigned long msecs) { at(task, Timebase::now() + msecs); }
+		void cancel(Task *task);
+
+		void run();
+		unsigned long untilNext();
+
+		unsigned long	worst_latency;		// Msecs, latest a task has run past its deadline
+		unsigned long	worst_pass;			// Usecs, longest pass including the tasks it ran
+		unsigned long	idle_pass;			// Usecs, the last pass that had nothing due
+
+	private:
+		Task			*_slots[SCHEDULER_SLOTS];
+		Task			*_ready;			// Already due when scheduled
+		Task			*_pending;			// Taken off _ready or a slot by run(), still to be run this pass
+		unsigned long	_tick;				// Last millis() whose slot has been looked at
+		Task			*_running;			// Task whose callback is running, until it cancels itself
+
+		void insert(Task *task, Task **list) { task->next = *list; *list = task; task->queued = true; }
+		bool unlink(Task *task, Task **list);
+		void dispatch(Task *task, unsigned long now);
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * Scheduler Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+Scheduler::Scheduler()
+{
+	for (uint8_t i = 0; i < SCHEDULER_SLOTS; i++) _slots[i] = NULL;
+	_ready			= NULL;
+	_pending		= NULL;
+	_running		= NULL;
+	_tick			= Timebase::now();
+	worst_latency	= 0;
+	worst_pass		= 0;
+	idle_pass		= 0;
+}
+
+void Scheduler::add(Task *task, TaskCallback callback, unsigned long period)
+{
+	task->callback	= callback;
+	task->period	= period;
+	task->next		= NULL;
+	task->queued	= false;
+	if (period) after(task, period);
+}
+
+void Scheduler::at(Task *task, unsigned long deadline)
+{
+	cancel(task);
+	task->deadline = deadline;
+
+	// The slot for a tick that's been looked at won't come round again for a whole turn.
+	if (Timebase::reached(deadline, _tick)) insert(task, &_ready);
+	else insert(task, &_slots[deadline & (SCHEDULER_SLOTS - 1)]);
+}
+
+void Scheduler::cancel(Task *task)
+{
+	if (task == _running) _running = NULL;
+	if (!task->queued) return;
+	if (!unlink(task, &_ready) && !unlink(task, &_pending))
+		unlink(task, &_slots[task->deadline & (SCHEDULER_SLOTS - 1)]);
+	task->queued = false;
+}
+
+//--------------------------------------
+//	+ run
+//	Call from loop(). Runs the tasks made ready last pass, then walks
+//	the slots from the last tick looked at up to now.
+void Scheduler::run()
+{
+	unsigned long started	= Timebase::nowMicros();
+	unsigned long now		= Timebase::now();
+	bool ran				= false;
+
+	// Tasks are taken off _pending one at a time, so a callback that moves or
+	// cancels one still waiting there unlinks it. Tasks scheduled from here on
+	// wait for the next pass.
+	_pending = _ready;
+	_ready = NULL;
+	while (_pending) {
+		Task *task = _pending;
+		_pending = task->next;
+		task->queued = false;
+		dispatch(task, now);
+		ran = true;
+	}
+
+	unsigned long steps = now - _tick;
+	if (steps > SCHEDULER_SLOTS) steps = SCHEDULER_SLOTS;	// Fell a whole turn behind, every slot once will do
+	_tick = now;
+
+	for (unsigned long s = steps; s > 0; s--) {
+		Task **slot = &_slots[(now - s + 1) & (SCHEDULER_SLOTS - 1)];
+		_pending = *slot;
+		*slot = NULL;
+		while (_pending) {
+			Task *task = _pending;
+			_pending = task->next;
+			if (Timebase::reached(task->deadline, now)) {
+				task->queued = false;
+				dispatch(task, now);
+				ran = true;
+			} else insert(task, slot);		// Due on a later turn of the wheel
+		}
+	}
+
+	unsigned long spent = Timebase::elapsed(started, Timebase::nowMicros());
+	if (!ran) idle_pass = spent;
+	if (spent > worst_pass) worst_pass = spent;
+}
+
+void Scheduler::dispatch(Task *task, unsigned long now)
+{
+	unsigned long late = Timebase::elapsed(task->deadline, now);
+	if (late > worst_latency) worst_latency = late;
+
+	_running = task;
+	task->callback();
+
+	if (task->period && !task->queued && _running == task) {
+		unsigned long next = task->deadline + task->period;
+		at(task, Timebase::reached(next, now) ? now + task->period : next);	// Don't try to catch up on missed runs
+	}
+	_running = NULL;
+}
+
+//--------------------------------------
+//	+ untilNext
+//	Msecs until the earliest queued deadline, 0 if something is due,
+//	0xFFFFFFFF if nothing is queued. For deciding how long to sleep;
+//	walks every task, which is only a handful.
+unsigned long Scheduler::untilNext()
+{
+	if (_ready) return 0;
+
+	unsigned long now	= Timebase::now();
+	unsigned long best	= 0xFFFFFFFFUL;
+	for (uint8_t i = 0; i < SCHEDULER_SLOTS; i++) {
+		for (Task *task = _slots[i]; task; task = task->next) {
+			if (Timebase::reached(task->deadline, now)) return 0;
+			if (task->deadline - now < best) best = task->deadline - now;
+		}
+	}
+	return best;
+}
+
+bool Scheduler::unlink(Task *task, Task **list)
+{
+	for (; *list; list = &(*list)->next) {
+		if (*list == task) {
+			*list = task->next;
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ *  ShutterLog.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  A record of when the shutter line actually moved. Every edge goes
+ *  into a small ring with its error against the planned time, and the
+ *  running min/max/mean/standard deviation of those errors are kept
+ *  for the whole session, to show afterwards whether it fired on time.
+ *
+ */
+
+#ifndef ShutterLog_h
+#define ShutterLog_h
+
+#include "WProgram.h"
+
+#define SHUTTER_LOG_SIZE	16			// Stamps kept, must be a power of two. A full burst's edges must fit.
+#define SHUTTER_LOG_CLAMP	16777216L	// us, errors are capped here for the stats so the sums can't overflow
+
+struct ShutterStamp
+{
+	unsigned long		at;				// micros() when the edge went out
+	long				error;			// us after (+) or before (-) its planned time
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * ShutterLog
+ * *  ---------------------------------------------------------
+ * *	record() is the only thing the hot path calls: it stores a
+ * *	stamp and moves the head on, and is safe from an ISR. update()
+ * *	folds new stamps into the stats with integer sums, from loop().
+ * *	If more than SHUTTER_LOG_SIZE edges go by between updates the
+ * *	oldest are lost to the stats and counted in dropped.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class ShutterLog
+{
+	public:
+		ShutterLog() { reset(); }
+
+		void reset();
+		void record(unsigned long planned, unsigned long actual);
+		void update();
+
+		ShutterStamp stamp(uint8_t back) { return _stamps[(_head - 1 - back) & (SHUTTER_LOG_SIZE - 1)]; }	// 0 is the latest
+
+		long mean() { return count ? (long)(_sum / (int64_t)count) : 0; }
+		unsigned long deviation();
+
+		unsigned long	count;			// Edges folded into the stats
+		unsigned long	dropped;
+		long			min_error;
+		long			max_error;
+
+	private:
+		ShutterStamp		_stamps[SHUTTER_LOG_SIZE];
+		volatile uint8_t	_head;		// Moved on by record() only
+		uint8_t				_folded;	// Moved on by update() only
+		int64_t				_sum;
+		uint64_t			_sum_squares;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * ShutterLog Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void ShutterLog::reset()
+{
+	uint8_t sreg = SREG;
+	cli();
+	_head			= 0;
+	_folded			= 0;
+	count			= 0;
+	dropped			= 0;
+	min_error		= 0;
+	max_error		= 0;
+	_sum			= 0;
+	_sum_squares	= 0;
+	SREG = sreg;
+}
+
+void ShutterLog::record(unsigned long planned, unsigned long actual)
+{
+	ShutterStamp *stamp	= &_stamps[_head & (SHUTTER_LOG_SIZE - 1)];
+	stamp->at			= actual;
+	stamp->error		= (long)(actual - planned);
+	_head++;
+}
+
+void ShutterLog::update()
+{
+	uint8_t head = _head;					// One byte, reads whole even with the ISR about
+	uint8_t fresh = head - _folded;
+	if (fresh > SHUTTER_LOG_SIZE) {			// Lapped, the oldest have been written over
+		dropped	+= fresh - SHUTTER_LOG_SIZE;
+		_folded	= head - SHUTTER_LOG_SIZE;
+	}
+
+	for (; _folded != head; _folded++) {
+		long error = _stamps[_folded & (SHUTTER_LOG_SIZE - 1)].error;
+		error = constrain(error, -SHUTTER_LOG_CLAMP, SHUTTER_LOG_CLAMP);
+
+		if (count == 0 || error < min_error) min_error = error;
+		if (count == 0 || error > max_error) max_error = error;
+		_sum			+= error;
+		_sum_squares	+= (uint64_t)((int64_t)error * error);
+		count++;
+	}
+}
+
+//--------------------------------------
+//	+ deviation
+//	Standard deviation of the errors, us. From the sums as
+//	sqrt(E[x^2] - E[x]^2), with an integer square root.
+unsigned long ShutterLog::deviation()
+{
+	if (count < 2) return 0;
+
+	int64_t m			= _sum / (int64_t)count;
+	uint64_t mean_sq	= _sum_squares / count;
+	uint64_t variance	= mean_sq > (uint64_t)(m*m) ? mean_sq - (uint64_t)(m*m) : 0;
+
+	uint64_t root = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+	while (bit > variance) bit >>= 2;
+	while (bit) {
+		if (variance >= root + bit) {
+			variance	-= root + bit;
+			root		= (root >> 1) + bit;
+		} else root >>= 1;
+		bit >>= 2;
+	}
+	return (unsigned long)root;
+}
+
+#endif
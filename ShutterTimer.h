@@ -0,0 +1,226 @@
+/*
+ *  ShutterTimer.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Hardware timed pin edges. Timer1 free runs and its compare match A
+ *  interrupt raises and drops pins at scheduled ticks, so shutter timing
+ *  no longer depends on how long the rest of loop() takes.
+ *
+ *	Takes over Timer1, so PWM on pins 9 and 10 (and the Servo library)
+ *	can't be used alongside it.
+ *
+ */
+
+#ifndef ShutterTimer_h
+#define ShutterTimer_h
+
+#include "WProgram.h"
+#include <avr/interrupt.h>
+#include "ShutterLog.h"
+
+#define SHUTTER_TIMER_EDGES		32		// Queued edges, must be a power of two
+#define SHUTTER_TIMER_PRESCALE	64		// Same prescaler as Timer0, so a tick is one micros() step
+#define SHUTTER_TIMER_GUARD		25		// Ticks: don't hold interrupts off this close to an edge
+
+#define kMicrosPerTick			(SHUTTER_TIMER_PRESCALE / clockCyclesPerMicrosecond())
+
+struct ShutterEdge
+{
+	unsigned long		tick;			// Extended Timer1 count at which to write the pin
+	volatile uint8_t	*port;
+	uint8_t				mask;
+	uint8_t				level;
+	ShutterLog			*log;			// Where to stamp the edge when it goes out, or NULL
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * ShutterTimer
+ * *  ---------------------------------------------------------
+ * *	Static, there is only the one Timer1. Edges are kept in a
+ * *	ring sorted by tick; the ISR only ever looks at the head.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class ShutterTimer
+{
+	public:
+		static void begin();
+
+		static unsigned long ticks();
+		static unsigned long ticksAt(unsigned long at_micros);
+		static unsigned long ticksFor(unsigned long micros) { return micros / kMicrosPerTick; }
+
+		static bool schedule(uint8_t pin, uint8_t level, unsigned long tick, ShutterLog *log = NULL);
+		static void cancel(uint8_t pin);
+		static uint8_t pending() { return _count; }
+		static uint8_t room() { return SHUTTER_TIMER_EDGES - _count; }
+
+		static void service();
+		static volatile unsigned int	_high;			// Timer1 overflows, the top half of ticks()
+
+	private:
+		static ShutterEdge				_edges[SHUTTER_TIMER_EDGES];
+		static volatile uint8_t			_head;
+		static volatile uint8_t			_count;
+		static bool						_running;
+
+		static bool before(unsigned long a, unsigned long b) { return (long)(a - b) < 0; }
+};
+
+ShutterEdge				ShutterTimer::_edges[SHUTTER_TIMER_EDGES];
+volatile uint8_t		ShutterTimer::_head		= 0;
+volatile uint8_t		ShutterTimer::_count	= 0;
+volatile unsigned int	ShutterTimer::_high		= 0;
+bool					ShutterTimer::_running	= false;
+
+ISR(TIMER1_OVF_vect)
+{
+	ShutterTimer::_high++;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+	ShutterTimer::service();
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * ShutterTimer Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void ShutterTimer::begin()
+{
+	if (_running) return;
+
+	uint8_t sreg = SREG;
+	cli();
+	TCCR1A	= 0;						// Normal mode, free running 0-0xFFFF
+	TCCR1B	= _BV(CS11) | _BV(CS10);	// clk/64
+	TCNT1	= 0;
+	TIFR1	= _BV(TOV1) | _BV(OCF1A);
+	TIMSK1	= _BV(TOIE1);
+	_high	= 0;
+	_running = true;
+	SREG	= sreg;
+}
+
+//--------------------------------------
+//	+ ticks
+//	Timer1 extended to 32 bits by the overflow count. Catches an
+//	overflow that has happened but not been serviced yet.
+unsigned long ShutterTimer::ticks()
+{
+	uint8_t sreg = SREG;
+	cli();
+	unsigned int high	= _high;
+	unsigned int low	= TCNT1;
+	if ((TIFR1 & _BV(TOV1)) && low < 0x8000) high++;
+	SREG = sreg;
+
+	return ((unsigned long)high << 16) | low;
+}
+
+//--------------------------------------
+//	+ ticksAt
+//	Converts a micros() time into a tick. Timer0 and Timer1 share the
+//	prescaler, so the two clocks run in step once they're read together.
+unsigned long ShutterTimer::ticksAt(unsigned long at_micros)
+{
+	uint8_t sreg = SREG;
+	cli();
+	unsigned long now_us	= micros();
+	unsigned long now_tick	= ticks();
+	SREG = sreg;
+
+	return now_tick + (long)(at_micros - now_us) / (long)kMicrosPerTick;
+}
+
+//--------------------------------------
+//	+ schedule
+//	Queues a pin edge. Returns false if the queue is full. An edge
+//	whose tick has already passed goes out straight away.
+bool ShutterTimer::schedule(uint8_t pin, uint8_t level, unsigned long tick, ShutterLog *log)
+{
+	if (!_running) begin();
+	if (_count >= SHUTTER_TIMER_EDGES) return false;
+
+	// The insert below runs with interrupts off; let an imminent edge go first.
+	while (_count && (long)(_edges[_head].tick - ticks()) < SHUTTER_TIMER_GUARD) ;
+
+	uint8_t sreg = SREG;
+	cli();
+
+	uint8_t i = _count;					// Walk back from the tail, trains are usually queued in order
+	while (i > 0 && before(tick, _edges[(_head + i - 1) & (SHUTTER_TIMER_EDGES - 1)].tick)) {
+		_edges[(_head + i) & (SHUTTER_TIMER_EDGES - 1)] = _edges[(_head + i - 1) & (SHUTTER_TIMER_EDGES - 1)];
+		i--;
+	}
+	ShutterEdge *edge	= &_edges[(_head + i) & (SHUTTER_TIMER_EDGES - 1)];
+	edge->tick			= tick;
+	edge->port			= portOutputRegister(digitalPinToPort(pin));
+	edge->mask			= digitalPinToBitMask(pin);
+	edge->level			= level;
+	edge->log			= log;
+	_count++;
+
+	if (i == 0) service();				// New head, re-arm the compare
+	SREG = sreg;
+
+	return true;
+}
+
+//--------------------------------------
+//	+ cancel
+//	Drops every queued edge for a pin and leaves it low.
+void ShutterTimer::cancel(uint8_t pin)
+{
+	volatile uint8_t *port	= portOutputRegister(digitalPinToPort(pin));
+	uint8_t mask			= digitalPinToBitMask(pin);
+
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t kept = 0;
+	for (uint8_t i = 0; i < _count; i++) {
+		ShutterEdge *edge = &_edges[(_head + i) & (SHUTTER_TIMER_EDGES - 1)];
+		if (edge->port == port && edge->mask == mask) continue;
+		_edges[(_head + kept++) & (SHUTTER_TIMER_EDGES - 1)] = *edge;
+	}
+	_count = kept;
+	*port &= ~mask;
+	service();
+	SREG = sreg;
+}
+
+//--------------------------------------
+//	+ service
+//	Called with interrupts off. Writes every edge that is due, then
+//	points OCR1A at the next one. OCR1A only holds the low 16 bits, so
+//	an edge further out matches once per overflow until its turn comes.
+void ShutterTimer::service()
+{
+	while (_count) {
+		ShutterEdge *edge = &_edges[_head];
+
+		if (before(ticks(), edge->tick)) {
+			OCR1A	= (unsigned int)edge->tick;
+			TIFR1	= _BV(OCF1A);
+			TIMSK1	|= _BV(OCIE1A);
+			if ((long)(edge->tick - ticks()) > 1) return;	// Armed in time
+			continue;										// Slipped past while arming, fire now
+		}
+
+		if (edge->level) *edge->port |= edge->mask;
+		else *edge->port &= ~edge->mask;
+		
+		if (edge->log) {
+			unsigned long now_us = micros();
+			edge->log->record(now_us - (ticks() - edge->tick)*kMicrosPerTick, now_us);
+		}
+
+		_head = (_head + 1) & (SHUTTER_TIMER_EDGES - 1);
+		_count--;
+	}
+	TIMSK1 &= ~_BV(OCIE1A);
+}
+
+#endif
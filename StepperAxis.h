@@ -0,0 +1,415 @@
+/*
+ *  StepperAxis.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  A motorised slider on step/direction drivers: the slide itself, and
+ *  pan and tilt heads riding on it. Step pulses come from Timer1's
+ *  compare match B interrupt, alongside ShutterTimer on compare match A,
+ *  so they're as even as the shutter edges are.
+ *
+ *	Moves are trapezoidal: accelerate, cruise, decelerate. The step
+ *	delays for the ramp are worked out ahead of time, in loop(), with
+ *	the integer recurrence from Atmel's AVR446 app note, and the ISR
+ *	only ever looks one up. Decelerating reads the same table backwards.
+ *
+ *	All the motors run off the one step clock. The one with furthest
+ *	to go steps on every tick, the rest are spread over its steps with
+ *	Bresenham's line algorithm, so they start and finish together and
+ *	keep their proportions the whole way.
+ *
+ *	Or the slide crawls: one step every so often, for as long as it's left
+ *	running, while the frames go off. Gaps longer than a Timer1 lap
+ *	are waited out in pieces, so a step every few seconds works too.
+ *
+ *	The step ISR re-enables interrupts straight away, so a shutter edge
+ *	that comes due during a step waits only for the ISR's entry, not
+ *	the whole of it. Its 16-bit register accesses are the only parts
+ *	with interrupts off: they go through the Timer1 TEMP register, which
+ *	the shutter ISR uses too.
+ *
+ */
+
+#ifndef StepperAxis_h
+#define StepperAxis_h
+
+#include "WProgram.h"
+#include <avr/interrupt.h>
+#include <math.h>
+#include "Timebase.h"
+#include "ShutterTimer.h"
+
+#define STEPPER_RAMP_STEPS	64		// Longest ramp. Past this the cruise speed is capped.
+#define STEPPER_MIN_DELAY	25		// Ticks, 10 kHz tops
+#define STEPPER_START_TICKS	16		// Ticks from move() to the first step
+#define STEPPER_WAIT_CHUNK	0x8000	// Longer gaps are waited out this many ticks at a time
+#define STEPPER_AXES		3		// Motors on the step clock: slide, pan, tilt
+
+#define kTicksPerSecond		(1000000UL / kMicrosPerTick)
+
+struct StepperMotor
+{
+	volatile uint8_t	*port;			// The step pin, for writing directly
+	uint8_t				mask;
+	uint8_t				dir_pin;
+	char				dir;
+	volatile long		position;
+	unsigned long		steps;			// In this move
+	unsigned long		error;			// Bresenham, out of the lead motor's steps
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * StepperAxis
+ * *  ---------------------------------------------------------
+ * *	One of these at a time, compare match B is the only one going
+ * *	spare. Motor 0 is the slide. Speed and acceleration, in steps/sec
+ * *	and steps/sec^2, are for whichever motor has furthest to go.
+ * *	Ramped moves use 16-bit delays, so nothing slower than about
+ * *	four steps a second; crawl() has no such limit.
+ * *
+ * *	Every step's gap from the one before is measured against the
+ * *	gap it was given, for how steady the step rate really is.
+ * *
+ * *	The ISR does the same work every tick whatever the move: one
+ * *	add and compare per motor, one table lookup, no division. A
+ * *	few hundred cycles with three motors, so the 10 kHz top step
+ * *	rate leaves the shutter ISR plenty of room.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class StepperAxis
+{
+	public:
+		StepperAxis(uint8_t step_pin, uint8_t dir_pin);
+		bool addAxis(uint8_t step_pin, uint8_t dir_pin);
+		uint8_t numAxes() { return _num_motors; }
+
+		void setMotion(unsigned int speed, unsigned int accel);
+		bool move(long steps);					// The slide alone
+		bool moveBy(const long *steps);			// Every motor together, one count each
+		bool crawl(char dir, unsigned long period_us);
+		void stop();
+
+		bool isMoving() { return _moving; }
+		bool isCrawling() { return _moving && _period; }
+		long position(uint8_t axis = 0);
+		unsigned long moveTime(long steps);		// us a move of this many steps takes
+		unsigned long moveTime(const long *steps);
+		unsigned int topSpeed() { return kTicksPerSecond / _ramp[_ramp_len - 1]; }
+
+		void service();							// From the ISR only
+		static StepperAxis		*_running;
+
+		unsigned long	steps;					// Steps measured since the last move() or crawl()
+		unsigned long	worst_jitter;			// us, furthest a step's gap was from its plan
+		unsigned long	jitter_sum;				// us, for the mean
+
+	private:
+		StepperMotor			_motors[STEPPER_AXES];
+		uint8_t					_num_motors;
+
+		unsigned int			_ramp[STEPPER_RAMP_STEPS];	// Ticks between steps, slowest first
+		uint8_t					_ramp_len;					// Entries used, the last is the cruise delay
+
+		volatile bool			_moving;
+		unsigned long			_steps;			// The lead motor's, the length of the move
+		volatile unsigned long	_done;
+
+		unsigned long			_period;		// Crawling, ticks per step. 0 for a ramped move.
+		volatile unsigned long	_wait;			// Ticks still to go after this compare, before the step
+		unsigned long			_gap;			// Ticks this step was meant to come after the last
+		unsigned long			_last_tick;		// ShutterTimer::ticks() at the last step
+
+		bool begin();
+		void step();
+		void after(unsigned long delay);
+};
+
+StepperAxis *StepperAxis::_running = NULL;
+
+ISR(TIMER1_COMPB_vect, ISR_NOBLOCK)
+{
+	if (StepperAxis::_running) StepperAxis::_running->service();
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * StepperAxis Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+StepperAxis::StepperAxis(uint8_t step_pin, uint8_t dir_pin)
+{
+	_num_motors	= 0;
+	_moving		= false;
+	_steps		= 0;
+	_done		= 0;
+	_period		= 0;
+	_wait		= 0;
+	steps		= 0;
+	worst_jitter	= 0;
+	jitter_sum		= 0;
+
+	addAxis(step_pin, dir_pin);
+	setMotion(200, 400);
+}
+
+bool StepperAxis::addAxis(uint8_t step_pin, uint8_t dir_pin)
+{
+	if (_moving || _num_motors >= STEPPER_AXES) return false;
+
+	StepperMotor *motor	= &_motors[_num_motors];
+	motor->port			= portOutputRegister(digitalPinToPort(step_pin));
+	motor->mask			= digitalPinToBitMask(step_pin);
+	motor->dir_pin		= dir_pin;
+	motor->dir			= 1;
+	motor->position		= 0;
+	motor->steps		= 0;
+	motor->error		= 0;
+
+	pinMode(step_pin, OUTPUT);
+	pinMode(dir_pin, OUTPUT);
+	_num_motors++;
+	return true;
+}
+
+//--------------------------------------
+//	+ setMotion
+//	Builds the ramp table. c0 = 0.676 * f * sqrt(2 / accel) is the
+//	only float; after that c(n) = c(n-1) - 2 c(n-1) / (4n + 1), kept
+//	with 8 fraction bits, until it reaches the cruise delay.
+void StepperAxis::setMotion(unsigned int speed, unsigned int accel)
+{
+	if (_moving || speed == 0 || accel == 0) return;
+
+	unsigned long cruise = max(kTicksPerSecond / speed, (unsigned long)STEPPER_MIN_DELAY);
+	unsigned long c = (unsigned long)(0.676f * kTicksPerSecond * sqrt(2.0f / accel) * 256.0f);
+	c = constrain(c, cruise << 8, 0xFFFFUL << 8);
+
+	_ramp_len = 0;
+	for (unsigned long n = 1; _ramp_len < STEPPER_RAMP_STEPS; n++) {
+		_ramp[_ramp_len++] = c >> 8;
+		if ((c >> 8) <= cruise) break;
+		c -= (2*c) / (4*n + 1);
+		if ((c >> 8) < cruise) c = cruise << 8;
+	}
+}
+
+//--------------------------------------
+//	+ move
+//	Starts a relative move and returns. False if one is already going.
+bool StepperAxis::move(long steps)
+{
+	long all[STEPPER_AXES] = { steps };
+	return moveBy(all);
+}
+
+//--------------------------------------
+//	+ moveBy
+//	Starts a coordinated move, steps[] holding one relative count for
+//	each motor added. The longest sets the length and the ramp.
+bool StepperAxis::moveBy(const long *steps)
+{
+	if (_moving || _running) return false;
+
+	_steps = 0;
+	for (uint8_t i = 0; i < _num_motors; i++) {
+		StepperMotor *motor	= &_motors[i];
+		motor->dir			= steps[i] < 0 ? -1 : 1;
+		motor->steps		= steps[i] < 0 ? -steps[i] : steps[i];
+		if (motor->steps > _steps) _steps = motor->steps;
+	}
+	if (_steps == 0) return true;
+
+	for (uint8_t i = 0; i < _num_motors; i++)
+		_motors[i].error = _steps / 2;		// Half way, so the followers' steps fall mid-span
+	_period = 0;
+	return begin();
+}
+
+//--------------------------------------
+//	+ crawl
+//	Steps every period_us in one direction until stop(). Starts at
+//	that speed if the ramp's first step is quicker, otherwise takes
+//	the ramp up to it and then stays there.
+bool StepperAxis::crawl(char dir, unsigned long period_us)
+{
+	if (_moving || _running) return false;
+	if (dir == 0 || period_us == 0) return true;
+
+	_motors[0].dir	= dir > 0 ? 1 : -1;
+	_steps			= 0;
+	_period	= max(period_us / kMicrosPerTick, (unsigned long)STEPPER_MIN_DELAY);
+	return begin();
+}
+
+bool StepperAxis::begin()
+{
+	_done			= 0;
+	_wait			= 0;
+	steps			= 0;
+	worst_jitter	= 0;
+	jitter_sum		= 0;
+	for (uint8_t i = 0; i < _num_motors; i++)			// Well ahead of the first step
+		digitalWrite(_motors[i].dir_pin, _motors[i].dir > 0 ? HIGH : LOW);
+
+	ShutterTimer::begin();
+	uint8_t sreg = SREG;
+	cli();
+	_moving		= true;
+	_running	= this;
+	_gap		= STEPPER_START_TICKS;
+	_last_tick	= ShutterTimer::ticks();
+	OCR1B		= (unsigned int)_last_tick + STEPPER_START_TICKS;
+	TIFR1		= _BV(OCF1B);
+	TIMSK1		|= _BV(OCIE1B);
+	SREG = sreg;
+	return true;
+}
+
+void StepperAxis::stop()
+{
+	uint8_t sreg = SREG;
+	cli();
+	TIMSK1		&= ~_BV(OCIE1B);
+	_moving		= false;
+	if (_running == this) _running = NULL;
+	SREG = sreg;
+}
+
+long StepperAxis::position(uint8_t axis)
+{
+	if (axis >= _num_motors) return 0;
+
+	uint8_t sreg = SREG;
+	cli();
+	long position = _motors[axis].position;
+	SREG = sreg;
+	return position;
+}
+
+//--------------------------------------
+//	+ service
+//	Runs with interrupts on. Either another piece of a long gap, or
+//	the step itself. Pieces are never shorter than STEPPER_WAIT_CHUNK,
+//	so none can slip past its compare while being set up.
+void StepperAxis::service()
+{
+	if (_wait) {
+		unsigned long piece = _wait > 0xFFFF ? STEPPER_WAIT_CHUNK : _wait;
+		_wait -= piece;
+		uint8_t sreg = SREG;
+		cli();
+		OCR1B += (unsigned int)piece;
+		SREG = sreg;
+		return;
+	}
+	step();
+}
+
+//--------------------------------------
+//	+ step
+//	One step and the delay to the next. The pulses are raised first and
+//	dropped last; the bookkeeping in between is their width (a few us,
+//	more if the shutter ISR cuts in, drivers want one). Bounded: one
+//	pass over the motors, one table lookup.
+//
+//	Port writes are read-modify-write and the shutter ISR can cut in,
+//	so each is done with interrupts off, or a shutter edge on the same
+//	port could be written back over.
+void StepperAxis::step()
+{
+	uint8_t due = 0;
+	uint8_t sreg = SREG;
+	for (uint8_t i = 0; i < _num_motors; i++) {
+		StepperMotor *motor = &_motors[i];
+		if (_period) {
+			if (i > 0) break;					// Crawling is the slide's alone
+		} else {
+			motor->error += motor->steps;
+			if (motor->error < _steps) continue;
+			motor->error -= _steps;
+		}
+		cli();
+		*motor->port |= motor->mask;
+		SREG = sreg;
+		motor->position += motor->dir;
+		due |= 1 << i;
+	}
+
+	unsigned long now		= ShutterTimer::ticks();
+	unsigned long gap		= now - _last_tick;
+	unsigned long jitter	= (gap > _gap ? gap - _gap : _gap - gap) * kMicrosPerTick;
+	_last_tick = now;
+	if (_done) {								// The first has nothing before it to measure from
+		if (jitter > worst_jitter) worst_jitter = jitter;
+		jitter_sum += jitter;
+		steps++;
+	}
+
+	unsigned long done = ++_done;
+
+	if (_period) {
+		unsigned long i = done - 1;				// Up the ramp until it's quicker than the crawl
+		_gap = (i < _ramp_len && _ramp[i] > _period) ? _ramp[i] : _period;
+		after(_gap);
+	} else {
+		unsigned long left = _steps - done;
+		if (left == 0) {
+			cli();
+			TIMSK1		&= ~_BV(OCIE1B);
+			_moving		= false;
+			_running	= NULL;
+			SREG = sreg;
+		} else {
+			unsigned long i = done < left ? done - 1 : left - 1;	// Up the ramp, or back down it
+			if (i >= _ramp_len) i = _ramp_len - 1;					// Cruising
+			_gap = _ramp[i];
+			after(_gap);
+		}
+	}
+
+	for (uint8_t i = 0; i < _num_motors; i++) {
+		if (!(due & (1 << i))) continue;
+		cli();
+		*_motors[i].port &= ~_motors[i].mask;
+		SREG = sreg;
+	}
+}
+
+//--------------------------------------
+//	+ after
+//	Next compare, delay ticks on from the last one. OCR1B is only 16
+//	bits; past that the rest is left in _wait for service().
+void StepperAxis::after(unsigned long delay)
+{
+	_wait = delay > 0xFFFF ? delay - STEPPER_WAIT_CHUNK : 0;
+	uint8_t sreg = SREG;
+	cli();
+	OCR1B += (unsigned int)(_wait ? STEPPER_WAIT_CHUNK : delay);
+	SREG = sreg;
+}
+
+//--------------------------------------
+//	+ moveTime
+//	Adds up the delays the ISR will use, for planning around frames.
+unsigned long StepperAxis::moveTime(long steps)
+{
+	unsigned long n = steps > 0 ? steps : -steps;
+	if (n == 0) return 0;
+
+	unsigned long ticks = STEPPER_START_TICKS;
+	unsigned long half	= (n - 1) / 2;				// Delays on the way up; the same back down
+	unsigned long ramp	= min(half, (unsigned long)_ramp_len - 1);
+	for (unsigned long i = 0; i < ramp; i++) ticks += 2UL * _ramp[i];
+
+	ticks += (n - 1 - 2*ramp) * (unsigned long)_ramp[ramp];	// The middle, at the ramp's top
+	return ticks * kMicrosPerTick;
+}
+
+unsigned long StepperAxis::moveTime(const long *steps)
+{
+	long longest = 0;
+	for (uint8_t i = 0; i < _num_motors; i++) longest = max(longest, labs(steps[i]));
+	return moveTime(longest);
+}
+
+#endif
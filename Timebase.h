@@ -0,0 +1,98 @@
+/*
+ *  Timebase.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  One clock for everybody. Extends millis() and micros() past their
+ *  wraps (49 days and 71 minutes) to 64 bits, and gives wrap-safe
+ *  comparisons for the 32-bit values the components keep around.
+ *
+ */
+
+#ifndef Timebase_h
+#define Timebase_h
+
+#include "WProgram.h"
+
+typedef uint64_t	time64_t;		// Extended milliseconds or microseconds since boot
+
+#define kNever		(~(time64_t)0)
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * Timebase
+ * *  ---------------------------------------------------------
+ * *	The extended clocks only notice a wrap if they're read at
+ * *	least once per wrap period, so update() belongs in loop().
+ * *	Not for use from interrupts.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class Timebase
+{
+	public:
+		static void update() { millis64(); micros64(); }
+
+		static time64_t millis64();
+		static time64_t micros64();
+
+		// 32-bit views. Only compare them through the helpers below.
+		static unsigned long now() { return millis(); }
+		static unsigned long nowMicros() { return micros(); }
+
+		static unsigned long elapsed(unsigned long since, unsigned long now) { return now - since; }
+		static unsigned long elapsed(unsigned long since) { return millis() - since; }
+
+		// True once deadline has been reached. Good for deadlines up to half a wrap away.
+		static bool reached(unsigned long deadline, unsigned long now) { return (long)(now - deadline) >= 0; }
+		static bool reached(unsigned long deadline) { return reached(deadline, millis()); }
+		static bool reachedMicros(unsigned long deadline) { return reached(deadline, micros()); }
+
+		static unsigned long toMillis(float seconds);
+
+	private:
+		static unsigned long	_last_millis;
+		static unsigned long	_millis_wraps;
+		static unsigned long	_last_micros;
+		static unsigned long	_micros_wraps;
+};
+
+unsigned long	Timebase::_last_millis		= 0;
+unsigned long	Timebase::_millis_wraps		= 0;
+unsigned long	Timebase::_last_micros		= 0;
+unsigned long	Timebase::_micros_wraps		= 0;
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * Timebase Methods
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+time64_t Timebase::millis64()
+{
+	unsigned long now = millis();
+	if (now < _last_millis) _millis_wraps++;
+	_last_millis = now;
+
+	return ((time64_t)_millis_wraps << 32) | now;
+}
+
+time64_t Timebase::micros64()
+{
+	unsigned long now = micros();
+	if (now < _last_micros) _micros_wraps++;
+	_last_micros = now;
+
+	return ((time64_t)_micros_wraps << 32) | now;
+}
+
+//--------------------------------------
+//	+ toMillis
+//	Seconds from the menu to milliseconds. The whole seconds are kept
+//	out of the float multiply, which would round days-long intervals.
+unsigned long Timebase::toMillis(float seconds)
+{
+	if (seconds <= 0.0f) return 0;
+
+	unsigned long whole = (unsigned long)seconds;
+	return whole*1000UL + (unsigned long)((seconds - whole)*1000.0f + 0.5f);
+}
+
+#endif
@@ -4,7 +4,28 @@
 #define DEBUG 					true
 #define __cplusplus				true
 
-#define MAX_STATES				8		// Most states/modes a menu item can have.
+#define MAX_PARAMS				17		// Most items a menu section can hold.
+#define RIG_CHANNELS			2		// Cameras driven at once, up to RIG_MAX_CHANNELS
+#define MAX_SECTIONS			(RIG_CHANNELS + 7)	// Most sections the menu can hold: one per camera, seven more.
+#define PROGRAM_EEPROM_ADDRESS	0		// Where the saved interval program lives
+
+#define KEY_SCAN_MSECS			20		// How often key events are taken off the keypad
+#define KEY_SLEEP_SCAN_MSECS	250		// ...and while the LCD is asleep
+#define KEYPAD_LADDER			ADKeyModule	// Which resistor ladder the keypad has, see ADKeyboard.h
+#define STATUS_MSECS			500		// How often live readouts are redrawn
+#define LIGHT_SAMPLE_MSECS		250		// How often the light sensor is sampled
+#define LIGHT_SENSOR_PIN		1		// Analog input, the keypad has 0
+#define LIGHT_REPLAY_MSECS		60000	// Recorded sunset, time between its points
+#define STEPPER_STEP_PIN		4		// Slider driver, step/direction
+#define STEPPER_DIR_PIN			5
+#define PAN_STEP_PIN			16		// Pan head, on A2/A3
+#define PAN_DIR_PIN				17
+#define TILT_STEP_PIN			18		// Tilt head, on A4/A5
+#define TILT_DIR_PIN			19
+#define TRIGGER_SERVICE_MSECS	5		// How often an external trigger is looked after, well inside a shutter press
+
+#define USE_TIMER1_SHUTTER		true	// Shutter edges from Timer1 compare interrupts. Comment out to poll from loop().
+#define USE_POWER_SAVE			true	// Sleep between tasks, power down while the LCD is off. Comment out to spin.
 
 #define kStartIntervalometer	0
 #define kStopIntervalometer		1
@@ -13,9 +34,41 @@
 #define kExposureEvent 			11
 #define kTimelapseControlEvent	15
 #define kDelayEvent				12
+#define kFocusEvent				13
+#define kBulbEvent				14
+#define kRampEvent				16
+#define kRampEndEvent			17
+#define kRampDurationEvent		18
+#define kProgramEvent			19
+#define kBracketEvent			21
+#define kBracketStepEvent		22
+#define kLatePolicyEvent		23
+#define kLateToleranceEvent		24
+#define kTimingDumpEvent		25
+#define kTriggerEvent			26
+#define kTriggerEdgeEvent		27
+#define kTriggerHoldoffEvent	28
+#define kPrefocusEvent			29
+#define kAmbientEvent			30
+#define kLightSourceEvent		31
+#define kMoveEvent				32
+#define kSpeedEvent				33
+#define kAccelEvent				34
+#define kSettleEvent			35
+#define kMotionEvent			36
+#define kCrawlEvent				37
+#define kJogAxisEvent			38
+#define kJogEvent				39
+#define kKeyFrameEvent			40
+#define kSetKeyEvent			41
+#define kClearKeysEvent			42
+#define kSaveProgramEvent		43
 #define kLCDBacklightEvent		20
 #define kMemoryDebugNotice		50		
 
+#define kChannelStride			100		// Per-camera events are offset by channel*kChannelStride
+#define kChannelEvent(channel, event)	((channel)*kChannelStride + (event))
+
 enum eDisplayType { TEXT, INT, FLOAT, MODE, BUTTON };
 
 bool memory_debug = false;
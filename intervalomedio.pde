@@ -13,20 +13,57 @@
 #include <hardwareserial.h>
 
 #include "intervalomedio.h"
+#include "Timebase.h"
 #include "memdebug.h"
 #include "util.h"
 #include "LCDMenu.h"
 #include "Intervalometer.h"
+#include "IntervalometerRig.h"
 #include "ADKeyboard.h"
+#include "Scheduler.h"
+#include "PowerSaver.h"
+#include "AnalogSampler.h"
+#ifdef USE_TIMER1_SHUTTER
+#include "ExternalTrigger.h"
+#endif
 #include "Event.h"
 
 
 extern "C" void __cxa_pure_virtual() { for(;;); }
 
 
+Scheduler		*scheduler;
 LCDMenu 		*menu;
-ADKeyboard		*keypad;
-Intervalometer	*timelapse;
+ADKeyboard<KEYPAD_LADDER>	*keypad;
+IntervalometerRig	*rig;
+Intervalometer	*timelapse;		// Channel 0, the camera on the full menu section
+LCDMenuButton	*shutter_button[RIG_MAX_CHANNELS];	// Camera/bulb, per channel. Ramps and auto exposure switch it.
+LCDMenuButton	*program_button;
+LCDMenuButton	*bracket_button;
+LCDMenuParameter	*bracket_step_param;
+LCDMenuButton	*save_button;
+
+Task			key_task;
+Task			sleep_task;
+Task			frame_task;
+Task			status_task;
+Task			trigger_task;
+Task			light_task;
+
+const uint8_t	camera_pins[RIG_MAX_CHANNELS][2] = { {12, 13}, {10, 11}, {8, 9}, {6, 7} };	// Focus, shutter
+
+// Camera 4 is on 6 and 7, the comparator's AIN0/AIN1, every other pin is
+// taken. With four cameras the comparator trigger isn't offered.
+#if RIG_CHANNELS > 3
+#define TRIGGER_SOURCES	kTriggerComparator
+#else
+#define TRIGGER_SOURCES	(kTriggerComparator + 1)
+#endif
+
+unsigned long	ramp_end		= 30000;	// Bulb ramp target, msecs
+unsigned long	ramp_duration	= 3600;		// Bulb ramp length, secs
+bool			trigger_rising	= true;		// External trigger edge
+int				light_section	= -1;		// Menu section with the light level on it
 
 /*
 class ParameterFormatter {
@@ -56,82 +93,663 @@ void showmem()
 
 
 void handleEvent(Event);
+void showBracket(uint8_t channel);
+bool channelFree(uint8_t channel);
+void scanKeys();
+void sleepMenu();
+void refreshStatus();
+void runFrames();
+void serviceTrigger();
+void sampleLight();
+bool lightWanted();
+bool canPowerDown();
+void wakeFrames();
+void dumpTiming();
+void readCommand();
+void keypadSample(unsigned int value) { keypad->sample(value); }
+long focusLeadTime() { return timelapse->leadTime(); }
+long refusedFrames() { return timelapse->refused_frames; }
+long burstOverruns() { return timelapse->burst_overruns; }
+long worstPass() { return scheduler->worst_pass; }
+long worstLatency() { return scheduler->worst_latency; }
+long missedFrames() { return timelapse->missed_frames; }
+long lateFrames() { return timelapse->late_frames; }
+long worstLate() { return timelapse->worst_late / 1000; }
+long shutterEdges() { return timelapse->shutter_log.count; }
+long minError() { return timelapse->shutter_log.min_error; }
+long maxError() { return timelapse->shutter_log.max_error; }
+long meanError() { return timelapse->shutter_log.mean(); }
+long errorDeviation() { return timelapse->shutter_log.deviation(); }
+long delayRemaining() { return (timelapse->delayRemaining() + 999) / 1000; }
+#ifdef USE_TIMER1_SHUTTER
+StepperAxis		*slider;
+MotionPath		*path;
+uint8_t			jog_axis		= 0;
+unsigned int	key_frame		= 0;
+unsigned int	slider_speed	= 200;		// Steps/sec
+unsigned int	slider_accel	= 400;		// Steps/sec^2
+
+long sliderPosition() { return slider->position(); }
+long motionOverruns() { return timelapse->motion_overruns; }
+long stepJitter() { return slider->worst_jitter; }
+long panPosition() { return slider->position(1); }
+long tiltPosition() { return slider->position(2); }
+long pathKeys() { return path->keys(); }
+long triggerCount() { return ExternalTrigger::triggers; }
+long triggerWorst() { return ExternalTrigger::worst_latency; }
+long triggerMean() { return ExternalTrigger::timed ? ExternalTrigger::latency_sum / ExternalTrigger::timed : 0; }
+#endif
+unsigned int lightLevel() { return AnalogSampler::level(); }
+long lightReadout() { return AnalogSampler::level(); }
+long ambientWorst() { return timelapse->ambient.worst_error; }
+long ambientMean() { return timelapse->ambient.meanError(); }
+long energyNow() { return PowerSaver::energyPer1000(timelapse->frame_count); }
+long energyAwake() { return PowerSaver::energyPer1000(timelapse->frame_count, false); }
 
 void setup()
 {
 	int n, i;
 	Serial.begin(9600);
 	
+	scheduler	= new Scheduler;
 	menu 		= new LCDMenu;
-	keypad	 	= new ADKeyboard(0);
-	timelapse	= new Intervalometer(12, 13);
+	keypad	 	= new ADKeyboard<KEYPAD_LADDER>(0);
+	keypad->setDoubleClickKeys(_BV(2) | _BV(3));	// Next and previous. Enter clicks as soon as it's let go.
+	AnalogSampler::begin(LIGHT_SENSOR_PIN);
+	AnalogSampler::addChannel(keypad->pin(), keypadSample);	// Sampled in turn with the light sensor, all the time
+	rig			= new IntervalometerRig;
+	for (n = 0; n < RIG_CHANNELS; n++)
+		rig->addChannel(new Intervalometer(camera_pins[n][0], camera_pins[n][1]));
+	for (n = 0; n < rig->numChannels(); n++)
+		rig->channel(n)->ambient.setLevelCallback(lightLevel);
+	timelapse	= rig->channel(0);
+#ifdef USE_TIMER1_SHUTTER
+	slider		= new StepperAxis(STEPPER_STEP_PIN, STEPPER_DIR_PIN);
+	slider->addAxis(PAN_STEP_PIN, PAN_DIR_PIN);
+	slider->addAxis(TILT_STEP_PIN, TILT_DIR_PIN);
+	path		= new MotionPath;
+	timelapse->axis = slider;
+	timelapse->path = path;
+#endif
 	
 	menu->addSection(new LCDMenuSection);
 	LCDMenuSection *menu_sec = menu->getCurrentSection();
 	
-	char start_stop[MAX_STATES][15]	= { "Start\0", "Stop\0" };
-	char *btn_ptr[MAX_STATES];
-	
-	for (n = 0; n < 2; n++) {
-		btn_ptr[n] = start_stop[n];
-	}
+	// Buttons keep pointers to their labels, so these have to stay put. States
+	// are packed end to end in flash, the strings are split so "\0" never runs
+	// into a digit.
+	static const char start_stop[] PROGMEM		= "Start\0" "Stop";
+	static const char off_on[] PROGMEM			= "Off\0" "On";
+	static const char shutter_modes[] PROGMEM	= "Camera\0" "Bulb";
+	static const char ramp_curves[] PROGMEM		= "Off\0" "Linear\0" "Ease";
+	static const char programs[] PROGMEM		= "Off\0" "Built-in\0" "Saved";
+	static const char save_states[] PROGMEM		= "Save\0" "Saved\0" "No program";
+	static const char brackets[] PROGMEM		= "Off\0" "3 shots\0" "5 shots\0" "7 shots";
+	static const char late_policies[] PROGMEM	= "Fire\0" "Skip\0" "Shift grid";
+	static const char send[] PROGMEM			= "Send";
+	static const char trigger_sources[] PROGMEM	= "Off\0" "INT0 (pin 2)\0" "INT1 (pin 3)\0" "Comparator";
+	static const char edges[] PROGMEM			= "Rising\0" "Falling";
+	static const char ambient_modes[] PROGMEM	= "Off\0" "Exposure\0" "Interval";
+	static const char light_sources[] PROGMEM	= "Sensor\0" "Sunset replay";
+	static const char motion_modes[] PROGMEM	= "Shoot-move\0" "Continuous";
+	static const char axis_names[] PROGMEM		= "Slide\0" "Pan\0" "Tilt";
+	static const char set_key[] PROGMEM			= "Set";
+	static const char clear_keys[] PROGMEM		= "Clear";
+	static char camera_names[RIG_MAX_CHANNELS][9]	= { "Camera 1", "Camera 2", "Camera 3", "Camera 4" };
 
-	menu_sec->addParameter(new LCDMenuButton("Activity", kTimelapseControlEvent, btn_ptr, 2, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuButton(RIG_CHANNELS > 1 ? camera_names[0] : (char *)"Activity", kTimelapseControlEvent, start_stop, 2, 0, handleEvent));
 	menu_sec->addParameter(new LCDMenuParameter("Interval (secs)", kIntervalEvent, 20.0f, 0.50f, 0.00, 172800.0, true, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Delay (secs)", kDelayEvent, 0.0f, 5.0f, 0.0, 86400.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Starts in (secs)", delayRemaining));
+	menu_sec->addParameter(program_button = new LCDMenuButton("Program", kProgramEvent, programs, 3, 0, handleEvent));
+	menu_sec->addParameter(save_button = new LCDMenuButton("Save program", kSaveProgramEvent, save_states, 3, 0, handleEvent));
+	menu_sec->addParameter(shutter_button[0] = new LCDMenuButton("Shutter", kBulbEvent, shutter_modes, 2, 0, handleEvent));
 	menu_sec->addParameter(new LCDMenuParameter("Exposure (msecs)", kExposureEvent, 250.0f, 25.0f, 25.0, 1200000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuButton("Ramp", kRampEvent, ramp_curves, 3, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Ramp to (msecs)", kRampEndEvent, 30000.0f, 25.0f, 25.0, 1200000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Ramp (mins)", kRampDurationEvent, 60.0f, 1.0f, 1.0, 1440.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Ramp refused", refusedFrames));
+	menu_sec->addParameter(bracket_button = new LCDMenuButton("Bracket", kBracketEvent, brackets, 4, 0, handleEvent));
+	menu_sec->addParameter(bracket_step_param = new LCDMenuParameter("Bracket (1/3 EV)", kBracketStepEvent, 6.0f, 1.0f, 1.0, 9.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Burst overruns", burstOverruns));
+	menu_sec->addParameter(new LCDMenuButton("Focus", kFocusEvent, off_on, 2, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Lead (msecs)", focusLeadTime));
+	
+	// The other cameras get the basics, one section each.
+	for (i = 1; i < rig->numChannels(); i++) {
+		menu->addSection(new LCDMenuSection);
+		menu_sec = menu->getCurrentSection();
+		menu_sec->addParameter(new LCDMenuButton(camera_names[i], kChannelEvent(i, kTimelapseControlEvent), start_stop, 2, 0, handleEvent));
+		menu_sec->addParameter(new LCDMenuParameter("Interval (secs)", kChannelEvent(i, kIntervalEvent), 20.0f, 0.50f, 0.00, 172800.0, true, handleEvent));
+		menu_sec->addParameter(new LCDMenuParameter("Delay (secs)", kChannelEvent(i, kDelayEvent), 0.0f, 5.0f, 0.0, 86400.0, false, handleEvent));
+		menu_sec->addParameter(shutter_button[i] = new LCDMenuButton("Shutter", kChannelEvent(i, kBulbEvent), shutter_modes, 2, 0, handleEvent));
+		menu_sec->addParameter(new LCDMenuParameter("Exposure (msecs)", kChannelEvent(i, kExposureEvent), 250.0f, 25.0f, 25.0, 1200000.0, false, handleEvent));
+		menu_sec->addParameter(new LCDMenuButton("Focus", kChannelEvent(i, kFocusEvent), off_on, 2, 0, handleEvent));
+	}
+	// Following the light, first camera.
+	menu->addSection(new LCDMenuSection);
+	menu_sec = menu->getCurrentSection();
+	light_section = menu->getSectionIndex();
+	menu_sec->addParameter(new LCDMenuButton("Auto", kAmbientEvent, ambient_modes, 3, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Light level", lightReadout));
+	menu_sec->addParameter(new LCDMenuButton("Light from", kLightSourceEvent, light_sources, 2, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Auto worst (%)", ambientWorst));
+	menu_sec->addParameter(new LCDMenuReadout("Auto mean (%)", ambientMean));
+	
+	// Frame timing for the first camera, to tell whether a session kept to its slots.
+	menu->addSection(new LCDMenuSection);
+	menu_sec = menu->getCurrentSection();
+	menu_sec->addParameter(new LCDMenuButton("Late frames", kLatePolicyEvent, late_policies, 3, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Late limit (ms)", kLateToleranceEvent, 1000.0f, 100.0f, 0.0, 30000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Missed frames", missedFrames));
+	menu_sec->addParameter(new LCDMenuReadout("Late frames", lateFrames));
+	menu_sec->addParameter(new LCDMenuReadout("Worst late (ms)", worstLate));
+	menu_sec->addParameter(new LCDMenuButton("Timing to serial", kTimingDumpEvent, send, 1, 0, handleEvent));
+	
+	// Stats: shutter edges against their planned times, first camera.
+	menu->addSection(new LCDMenuSection);
+	menu_sec = menu->getCurrentSection();
+	menu_sec->addParameter(new LCDMenuReadout("Shutter edges", shutterEdges));
+	menu_sec->addParameter(new LCDMenuReadout("Min error (us)", minError));
+	menu_sec->addParameter(new LCDMenuReadout("Max error (us)", maxError));
+	menu_sec->addParameter(new LCDMenuReadout("Mean error (us)", meanError));
+	menu_sec->addParameter(new LCDMenuReadout("Std dev (us)", errorDeviation));
+	
+#ifdef USE_TIMER1_SHUTTER
+	// Slider, moved by the first camera between its frames or crawling through them.
+	menu->addSection(new LCDMenuSection);
+	menu_sec = menu->getCurrentSection();
+	menu_sec->addParameter(new LCDMenuButton("Motion", kMotionEvent, motion_modes, 2, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Move (steps)", kMoveEvent, 0.0f, 1.0f, -10000.0, 10000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Speed (steps/s)", kSpeedEvent, 200.0f, 10.0f, 10.0, 5000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Accel (steps/s2)", kAccelEvent, 400.0f, 50.0f, 50.0, 20000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Settle (msecs)", kSettleEvent, 500.0f, 50.0f, 0.0, 10000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Crawl (ms/step)", kCrawlEvent, 1000.0f, 100.0f, 10.0, 60000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Position", sliderPosition));
+	menu_sec->addParameter(new LCDMenuReadout("Move overruns", motionOverruns));
+	menu_sec->addParameter(new LCDMenuReadout("Step jitter (us)", stepJitter));
+	
+	// Keyframed path for slide, pan and tilt. Jog each to where it should be, then set the key.
+	menu->addSection(new LCDMenuSection);
+	menu_sec = menu->getCurrentSection();
+	menu_sec->addParameter(new LCDMenuButton("Jog axis", kJogAxisEvent, axis_names, 3, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Jog to (steps)", kJogEvent, 0.0f, 10.0f, -20000.0, 20000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Key at frame", kKeyFrameEvent, 0.0f, 10.0f, 0.0, 9999.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuButton("Key frame", kSetKeyEvent, set_key, 1, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuButton("Path", kClearKeysEvent, clear_keys, 1, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Keys", pathKeys));
+	menu_sec->addParameter(new LCDMenuReadout("Pan position", panPosition));
+	menu_sec->addParameter(new LCDMenuReadout("Tilt position", tiltPosition));
+	
+	// External trigger, takes over the first camera while it's on.
+	ExternalTrigger::begin(camera_pins[0][0], camera_pins[0][1]);
+	menu->addSection(new LCDMenuSection);
+	menu_sec = menu->getCurrentSection();
+	menu_sec->addParameter(new LCDMenuButton("Trigger", kTriggerEvent, trigger_sources, TRIGGER_SOURCES, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuButton("Trigger edge", kTriggerEdgeEvent, edges, 2, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuParameter("Holdoff (msecs)", kTriggerHoldoffEvent, 500.0f, 50.0f, 0.0, 60000.0, false, handleEvent));
+	menu_sec->addParameter(new LCDMenuButton("Pre-focus", kPrefocusEvent, off_on, 2, 0, handleEvent));
+	menu_sec->addParameter(new LCDMenuReadout("Triggers", triggerCount));
+	menu_sec->addParameter(new LCDMenuReadout("Worst lag (us)", triggerWorst));	// Comparator triggers only, the rest have no edge time
+	menu_sec->addParameter(new LCDMenuReadout("Mean lag (us)", triggerMean));
+#endif
+	
+	menu->addSection(new LCDMenuSection);
+	menu_sec = menu->getCurrentSection();
+	menu_sec->addParameter(new LCDMenuReadout("Loop (usecs)", worstPass));
+	menu_sec->addParameter(new LCDMenuReadout("Task late (ms)", worstLatency));
+	menu_sec->addParameter(new LCDMenuReadout("mAh/1000 frames", energyNow));
+	menu_sec->addParameter(new LCDMenuReadout("Unslept mAh/1000", energyAwake));
 	menu_sec->addParameter(new LCDMenuParameter("Backlight", kLCDBacklightEvent, 29.0f, 1.0f, 0.0, 29.0, false, handleEvent));
-	menu_sec->addParameter(new LCDMenuButton("Memory Debug", kMemoryDebugNotice, btn_ptr, 2, 0, handleEvent));	
+	menu_sec->addParameter(new LCDMenuButton("Memory Debug", kMemoryDebugNotice, start_stop, 2, 0, handleEvent));	
+	menu->selectSection(0);
+	
+	scheduler->add(&key_task, scanKeys, KEY_SCAN_MSECS);
+	scheduler->add(&status_task, refreshStatus, STATUS_MSECS);
+	scheduler->add(&sleep_task, sleepMenu);
+	scheduler->at(&sleep_task, menu->sleepDeadline());
+	scheduler->add(&frame_task, runFrames);
+	scheduler->add(&trigger_task, serviceTrigger);
+	scheduler->add(&light_task, sampleLight, LIGHT_SAMPLE_MSECS);
+	wakeFrames();
+	PowerSaver::begin();
+	
 	if (memory_debug) showmem();
 }
 
 
 void loop()
 {  
-	int key = keypad->readKeyboard();
-	if (key != -1) {
-		switch (key) {
-			case 2:
-				menu->nextItem();
+	Timebase::update();					// Keep the extended clocks ahead of the millis()/micros() wraps
+	scheduler->run();					// Everything else is a task
+#ifdef USE_POWER_SAVE
+	PowerSaver::sleep(scheduler->untilNext(), canPowerDown());
+#endif
+}
+
+// Powered down, Timer0 and Timer1 stop, and with Timer0 the ADC triggers: the keypad is
+// only read in the idle stretch before each wake. Once a key shows, stay up to settle it.
+bool canPowerDown()
+{
+#ifdef USE_TIMER1_SHUTTER
+	if (ShutterTimer::pending()) return false;
+	if (ExternalTrigger::getSource() != kTriggerOff) return false;	// Its edges can't wake us from power-down
+	if (slider->isMoving()) return false;
+#endif
+	return menu->isAsleep() && !rig->isBusy() && !AnalogSampler::isBusy() && !keypad->isBouncing();
+}
+
+void scanKeys()
+{
+	KeyEvent event;
+	bool pressed = false;
+	while (keypad->nextEvent(&event)) {
+		if (event.type == kKeyUp) continue;
+		pressed = true;
+		
+		switch (event.type) {
+			case kKeyDown:			// Up and down act straight away
+			case kKeyRepeat:
+				switch (event.key) {
+					case 1:
+						menu->incCurrentParam(1, event.multiplier);
+						break;
+					case 4:
+						menu->incCurrentParam(-1, event.multiplier);
+						break;
+					case 2:				// Held next/previous scroll, a single press waits for its click
+						if (event.type == kKeyRepeat) menu->nextItem();
+						break;
+					case 3:
+						if (event.type == kKeyRepeat) menu->prevItem();
+						break;
+					default:
+						break;
+				}
+				break;
+				
+			case kKeyClick:			// Enter, next and previous have gestures, so act once it's sure this wasn't one
+				switch (event.key) {
+					case 2:
+						menu->nextItem();
+						break;
+					case 3:
+						menu->prevItem();
+						break;
+					case 0:
+						menu->clickCurrentParam();
+						if (memory_debug) showmem();
+						break;
+					default:
+						break;
+				}
 				break;
-			case 3:
-				menu->prevItem();
+				
+			case kKeyLongPress:		// Hold enter: fire the camera whose section is showing
+				if (event.key == 0 && menu->getSectionIndex() < rig->numChannels() && channelFree(menu->getSectionIndex())) {
+					rig->channel(menu->getSectionIndex())->triggerShutter();
+					wakeFrames();
+				}
 				break;
-			case 1:
-				menu->incCurrentParam(1);
+				
+			case kKeyDoubleClick:	// Double next/previous: a whole section at a time
+				if (event.key == 2) menu->nextSection();
+				else if (event.key == 3) menu->prevSection();
 				break;
-			case 4:
-				menu->incCurrentParam(-1);
+				
+			case kKeyChord:			// Next, then enter straight after with next still held: timing to serial
+				if (event.key == 0 && event.other == 2) dumpTiming();
 				break;
-			case 0:
-				menu->clickCurrentParam();
-				timelapse->triggerShutter();
-				if (memory_debug) showmem();
+				
+			default:
+				break;
+		}
+	}
+	if (pressed) {
+		scheduler->at(&sleep_task, menu->sleepDeadline());
+		if (!status_task.queued) scheduler->after(&status_task, STATUS_MSECS);
+		if (!light_task.queued && lightWanted()) scheduler->after(&light_task, 0);	// Auto turned on, or the level's showing
+	}
+	if (menu->isAsleep()) scheduler->after(&key_task, KEY_SLEEP_SCAN_MSECS);	// Just enough to notice a key to wake up
+	readCommand();
+	menu->printMenu();
+}
+
+//--------------------------------------
+//	+ readCommand
+//	Single character commands over serial. 'd' dumps the timing and
+//	shutter stats. Nothing is heard while powered down.
+void readCommand()
+{
+	while (Serial.available() > 0) {
+		switch (Serial.read()) {
+			case 'd':
+				dumpTiming();
 				break;
 			default:
 				break;
 		}
-	//	menu->stayAwake();
-	//	menu->setDirty(true);
 	}
-	timelapse->loop();
+}
+
+void sleepMenu()
+{
+	if (Timebase::reached(menu->sleepDeadline())) menu->sleep();
+	else scheduler->at(&sleep_task, menu->sleepDeadline());
+}
+
+void refreshStatus()
+{
+	if (menu->isAsleep()) {
+		scheduler->cancel(&status_task);	// Back when a key wakes the screen
+		return;
+	}
+	menu->refreshLive();
 	menu->printMenu();
-//	delay(30);
+}
+
+void sampleLight()
+{
+	if (!lightWanted()) {
+		scheduler->cancel(&light_task);	// Back when a key turns auto on or shows the level
+		return;
+	}
+	AnalogSampler::start();				// Returns straight away, the ADC interrupt does the rest
+}
+
+// Some camera follows the light, or the screen shows its level. A recorded sunset needs no sampling.
+bool lightWanted()
+{
+	if (AnalogSampler::isPlaying()) return false;
+	for (uint8_t i = 0; i < rig->numChannels(); i++)
+		if (rig->channel(i)->ambient.isActive()) return true;
+	return !menu->isAsleep() && menu->getSectionIndex() == light_section;
+}
+
+void serviceTrigger()
+{
+#ifdef USE_TIMER1_SHUTTER
+	ExternalTrigger::service();
+	if (ExternalTrigger::getSource() != kTriggerOff) scheduler->after(&trigger_task, TRIGGER_SERVICE_MSECS);
+#endif
+}
+
+void runFrames()
+{
+	rig->loop();
+	
+	time64_t wake = rig->nextWake();
+	if (wake == kNever) return;			// Nothing running, wakeFrames() will get us going again
+	
+	time64_t now = Timebase::micros64();
+	scheduler->at(&frame_task, Timebase::now() + (wake > now ? (unsigned long)((wake - now)/1000) : 0));
+}
+
+// Something changed a channel, have the rig look again on the next pass.
+void wakeFrames()
+{
+	rig->refresh();
+	scheduler->at(&frame_task, Timebase::now());
+}
+
+//--------------------------------------
+//	+ dumpTiming
+//	Frame timing and shutter stats per camera over serial, then the
+//	latest stamps, for checking a session after the fact. It goes out
+//	over the LCD's line too, so the screen is redrawn.
+void dumpTiming()
+{
+	for (int i = 0; i < rig->numChannels(); i++) {
+		Intervalometer *channel = rig->channel(i);
+		Serial.print("\ncam ");
+		Serial.print(i + 1);
+		Serial.print(" frames ");
+		Serial.print(channel->frame_count);
+		Serial.print(" missed ");
+		Serial.print(channel->missed_frames);
+		Serial.print(" late ");
+		Serial.print(channel->late_frames);
+		Serial.print(" worst_us ");
+		Serial.print(channel->worst_late);
+		Serial.print(" policy ");
+		Serial.print((int)channel->late_policy);
+		Serial.print(" move_overruns ");
+		Serial.print(channel->motion_overruns);
+		
+		ShutterLog *log = &channel->shutter_log;
+		Serial.print("\ncam ");
+		Serial.print(i + 1);
+		Serial.print(" edges ");
+		Serial.print(log->count);
+		Serial.print(" min_us ");
+		Serial.print(log->min_error);
+		Serial.print(" max_us ");
+		Serial.print(log->max_error);
+		Serial.print(" mean_us ");
+		Serial.print(log->mean());
+		Serial.print(" sd_us ");
+		Serial.print(log->deviation());
+		Serial.print(" dropped ");
+		Serial.print(log->dropped);
+		for (uint8_t n = log->count < SHUTTER_LOG_SIZE ? log->count : SHUTTER_LOG_SIZE; n > 0; n--) {
+			ShutterStamp stamp = log->stamp(n - 1);		// Oldest first
+			Serial.print("\n  ");
+			Serial.print(stamp.at);
+			Serial.print(" ");
+			Serial.print(stamp.error);
+		}
+	}
+#ifdef USE_TIMER1_SHUTTER
+	Serial.print("\nslider steps ");
+	Serial.print(slider->steps);
+	Serial.print(" worst_jitter_us ");
+	Serial.print(slider->worst_jitter);
+	Serial.print(" mean_jitter_us ");
+	Serial.print(slider->steps ? slider->jitter_sum / slider->steps : 0);
+	Serial.print("\ntrigger count ");
+	Serial.print(ExternalTrigger::triggers);
+	Serial.print(" timed ");				// Comparator only, INT0/INT1 edges have no hardware time
+	Serial.print(ExternalTrigger::timed);
+	Serial.print(" worst_us ");
+	Serial.print(ExternalTrigger::worst_latency);
+	for (uint8_t bin = 0; bin < TRIGGER_BINS; bin++) {
+		Serial.print("\n  <");
+		if (bin == TRIGGER_BINS - 1) Serial.print("inf");
+		else Serial.print((bin + 1)*TRIGGER_BIN_US);
+		Serial.print("us ");
+		Serial.print(ExternalTrigger::histogram[bin]);
+	}
+#endif
+	Serial.println();
+	menu->setDirty(true);
+}
+
+// A bracket change is refused mid-burst and switches to bulb, so show what the camera took from it.
+void showBracket(uint8_t channel)
+{
+	Intervalometer *timelapse = rig->channel(channel);
+	bracket_button->showValue(timelapse->bracket_shots / 2);
+	bracket_step_param->showValue(timelapse->bracket_step);
+	shutter_button[channel]->showValue(timelapse->bulb);
+}
+
+// While it's on, the trigger has the first camera's pins. That camera can't be run from the menu as well.
+bool channelFree(uint8_t channel)
+{
+#ifdef USE_TIMER1_SHUTTER
+	if (channel == 0 && ExternalTrigger::getSource() != kTriggerOff) return false;
+#endif
+	return true;
 }
 
 void handleEvent(Event event) {
-	switch (event.source) {
+	uint8_t channel = event.source / kChannelStride;
+	Intervalometer *timelapse = rig->channel(channel);
+	
+	switch (event.source % kChannelStride) {
 		case kIntervalEvent:
 			timelapse->setInterval(event.value);
 			break;
 			
+		case kDelayEvent:
+			timelapse->start_delay = (unsigned long)event.value * 1000UL;	// From the next start
+			break;
+			
+		case kExposureEvent:
+			timelapse->setExposure((unsigned long)event.value);
+			break;
+			
+		case kBulbEvent:
+			timelapse->setBulb(event.state == 1);
+			shutter_button[channel]->showValue(timelapse->bulb);	// Back to bulb if something needs it
+			break;
+			
+		case kProgramEvent:
+			timelapse->setProgram((eProgramSource)event.state);
+			program_button->showValue(timelapse->program.getSource());	// Off again if nothing's been saved
+			save_button->showValue(0);
+			break;
+			
+		case kSaveProgramEvent:
+			save_button->showValue(timelapse->saveProgram() ? 1 : 2);
+			break;
+			
+		case kRampEvent:
+			if (event.state == kRampOff) timelapse->ramp.stop();
+			else timelapse->startRamp(ramp_end, ramp_duration, (eRampCurve)event.state);
+			shutter_button[channel]->showValue(timelapse->bulb);	// A ramp switches to bulb
+			break;
+			
+		case kRampEndEvent:
+			ramp_end = (unsigned long)event.value;
+			break;
+			
+		case kRampDurationEvent:
+			ramp_duration = (unsigned long)event.value * 60;
+			break;
+			
+		case kBracketEvent:
+			timelapse->setBracket(event.state*2 + 1, timelapse->bracket_step);
+			showBracket(channel);
+			break;
+			
+		case kBracketStepEvent:
+			timelapse->setBracket(timelapse->bracket_shots, (uint8_t)event.value);
+			showBracket(channel);
+			break;
+			
+		case kLatePolicyEvent:
+			timelapse->late_policy = (eLatePolicy)event.state;
+			break;
+			
+		case kLateToleranceEvent:
+			timelapse->late_tolerance = (int)event.value;
+			break;
+			
+		case kTimingDumpEvent:
+			dumpTiming();
+			break;
+			
+#ifdef USE_TIMER1_SHUTTER
+		case kTriggerEvent:
+			if (event.state != kTriggerOff) {
+				timelapse->stop();				// The trigger has the first camera's pins now
+				ExternalTrigger::press_us = timelapse->pressTime()*1000UL;
+				ExternalTrigger::reset();
+				scheduler->after(&trigger_task, TRIGGER_SERVICE_MSECS);
+			}
+			ExternalTrigger::setSource((eTriggerSource)event.state, trigger_rising);
+			break;
+			
+		case kTriggerEdgeEvent:
+			trigger_rising = (event.state == 0);
+			ExternalTrigger::setSource(ExternalTrigger::getSource(), trigger_rising);
+			break;
+			
+		case kTriggerHoldoffEvent:
+			ExternalTrigger::holdoff = (unsigned long)event.value;
+			break;
+			
+		case kPrefocusEvent:
+			ExternalTrigger::setPrefocus(event.state == 1);
+			break;
+			
+		case kMoveEvent:
+			timelapse->move_steps = (long)event.value;
+			break;
+			
+		case kSpeedEvent:
+			slider_speed = (unsigned int)event.value;
+			slider->setMotion(slider_speed, slider_accel);
+			break;
+			
+		case kAccelEvent:
+			slider_accel = (unsigned int)event.value;
+			slider->setMotion(slider_speed, slider_accel);
+			break;
+			
+		case kSettleEvent:
+			timelapse->settle_time = (unsigned int)event.value;
+			break;
+			
+		case kMotionEvent:
+			timelapse->motion_mode = (eMotionMode)event.state;
+			break;
+			
+		case kCrawlEvent:
+			timelapse->crawl_period = (unsigned long)event.value;
+			break;
+			
+		case kJogAxisEvent:
+			jog_axis = event.state;
+			break;
+			
+		case kJogEvent: {
+			long steps[STEPPER_AXES] = { 0 };
+			steps[jog_axis] = (long)event.value - slider->position(jog_axis);
+			slider->moveBy(steps);
+			break;
+		}
+			
+		case kKeyFrameEvent:
+			key_frame = (unsigned int)event.value;
+			break;
+			
+		case kSetKeyEvent: {
+			long position[STEPPER_AXES];
+			for (uint8_t i = 0; i < STEPPER_AXES; i++) position[i] = slider->position(i);
+			path->setKey(key_frame, position);
+			break;
+		}
+			
+		case kClearKeysEvent:
+			path->clear();
+			break;
+#endif
+			
+		case kAmbientEvent:
+			timelapse->startAmbient((eAmbientMode)event.state);
+			shutter_button[channel]->showValue(timelapse->bulb);	// So does following the light with the exposure
+			break;
+			
+		case kLightSourceEvent:
+			if (event.state == 1) AnalogSampler::play(kSunsetCurve, SUNSET_POINTS, LIGHT_REPLAY_MSECS);
+			else AnalogSampler::stopPlaying();
+			break;
+			
+		case kFocusEvent:
+			timelapse->focus = (event.state == 1);
+			break;
+			
 		case kLCDBacklightEvent:
 			menu->backlightBrightness((int)(event.value));
 			break;
 			
 		case kTimelapseControlEvent:
 		Serial << "State: " << event.state << " . \n";
-			if (event.state == kStartIntervalometer)
-				timelapse->start();
+			if (event.state == kStartIntervalometer) {
+				if (channelFree(channel)) timelapse->start();
+			}
 			else
 				timelapse->stop();
 			break;
@@ -143,5 +761,6 @@ void handleEvent(Event event) {
 		default:
 			break;
 	}
+	wakeFrames();						// Any of these can move a channel's next wake, or start it again
 	if (memory_debug) showmem();
 }
\ No newline at end of file
@@ -0,0 +1,241 @@
+/*
+ *  frame_grid.cpp
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Host checks for Intervalometer's frame grid: start + n * lapse_time,
+ *	re-based when the interval changes, and the late frame policies.
+ *	Runs the polling backend against a simulated clock and watches the
+ *	shutter pin for rising edges.
+ *
+ */
+
+#include "WProgram.h"
+#include "Intervalometer.h"
+
+#define FOCUS_PIN		12
+#define SHUTTER_PIN		13
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { if (!(condition)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * * * Bench
+ * *  ---------------------------------------------------------
+ * *	One camera on the polling backend, and its shutter line.
+ * *	pass() is one trip round loop(), then the time it took.
+ * *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+struct Bench
+{
+	Intervalometer	camera;
+	int				last;
+	unsigned long	start;
+
+	Bench(float interval) : camera(FOCUS_PIN, SHUTTER_PIN)
+	{
+		sim_us += 1000000;				// Timebase's wrap counting needs the clock to only go forward
+		sim_pins[FOCUS_PIN] = sim_pins[SHUTTER_PIN] = LOW;
+		camera.setBackend(kBackendPolling);
+		camera.setInterval(interval);
+		camera.start();
+		last	= LOW;
+		start	= micros();
+	}
+
+	// True if this pass opened the shutter
+	bool pass(unsigned long took)
+	{
+		camera.loop();
+		bool opened	= sim_pins[SHUTTER_PIN] && !last;
+		last		= sim_pins[SHUTTER_PIN];
+		sim_us		+= took;
+		return opened;
+	}
+
+	long since() { return (long)(micros() - start); }
+};
+
+//--------------------------------------
+//	+ checkDrift
+//	100k frames with loop passes anywhere from 0.1 to 40 ms. Each frame
+//	is late by at most the pass it waited on, and that never adds up.
+void checkDrift()
+{
+	Bench bench(2.0f);
+	unsigned long frames = 0;
+	long worst = 0;
+
+	srand(1);
+	while (frames < 100000) {
+		long at = bench.since();
+		if (!bench.pass(100 + rand() % 40000)) continue;
+
+		long error = at - (long)frames * 2000000L;
+		CHECK(error >= 0 && error < 40100, "frame %lu is %ld us off its slot", frames, error);
+		if (error > worst) worst = error;
+		frames++;
+	}
+	printf("drift: %lu frames, worst %ld us\n", frames, worst);
+}
+
+//--------------------------------------
+//	+ checkIntervalChange
+//	A new interval mid-session carries on from the last slot taken.
+void checkIntervalChange()
+{
+	Bench bench(2.0f);
+	unsigned long frames = 0;
+
+	while (frames < 13) {
+		if (frames == 10 && bench.since() > 19000000L) bench.camera.setInterval(5.0f);
+
+		long at = bench.since();
+		if (!bench.pass(1000)) continue;
+
+		long slot = frames < 10 ? (long)frames * 2000000L : 18000000L + (long)(frames - 9) * 5000000L;
+		CHECK(at >= slot && at - slot < 1000, "frame %lu at %ld us, slot %ld us", frames, at, slot);
+		frames++;
+	}
+}
+
+//--------------------------------------
+//	+ checkFocus
+//	With focus on, every frame gets its whole focus pulse and wait, the
+//	first one and one after a stall included.
+void checkFocus()
+{
+	Bench bench(2.0f);
+	bench.camera.focus = true;
+	bench.camera.start();
+	bench.start = micros();
+	unsigned long lead = bench.camera.leadTime()*1000UL;
+
+	long focused = -1;
+	unsigned long frames = 0;
+	int was_focused = LOW;
+	bool stalled = false;
+	while (frames < 10) {
+		long at = bench.since();
+		bool stall = frames == 5 && !stalled;	// Past frame 5's focus, not so far that frame 6 is late too
+		stalled |= stall;
+		bool opened = bench.pass(stall ? 2300000 : 1000);
+		if (sim_pins[FOCUS_PIN] && !was_focused) focused = at;
+		was_focused = sim_pins[FOCUS_PIN];
+		if (!opened) continue;
+
+		CHECK(focused >= 0 && at - focused >= (long)lead, "frame %lu opened %ld us after its focus, lead is %lu us", frames, at - focused, lead);
+		if (frames < 5) CHECK(at - (long)lead - (long)frames * 2000000L < 1000, "frame %lu at %ld us, off its slot", frames, at);
+		focused = -1;
+		frames++;
+	}
+	CHECK(bench.camera.late_frames == 1, "%lu late frames, expected the one after the stall", bench.camera.late_frames);
+}
+
+//--------------------------------------
+//	+ checkManualFocus
+//	A manual shot with focus on gets the same focus lead as a timed one.
+void checkManualFocus()
+{
+	Bench bench(60.0f);
+	bench.camera.focus = true;
+	while (bench.since() < 1000000L) bench.pass(1000);	// Clear of the first frame
+	
+	long pressed = bench.since();
+	bench.camera.triggerShutter();
+	long focused = -1;
+	while (bench.since() - pressed < 5000000L) {
+		long at = bench.since();
+		if (sim_pins[FOCUS_PIN] && focused < 0) focused = at;
+		if (bench.pass(1000)) {
+			CHECK(focused >= 0 && at - focused >= (long)bench.camera.leadTime()*1000L, "manual shot opened %ld us after its focus", at - focused);
+			return;
+		}
+	}
+	CHECK(false, "manual shot never opened");
+}
+
+//--------------------------------------
+//	+ checkLate
+//	Loop stalls for 7.3 s every 20 s. Whatever the policy, every slot
+//	is either fired or counted missed, and the frames land where the
+//	policy says they should.
+void checkLate(eLatePolicy policy)
+{
+	Bench bench(2.0f);
+	bench.camera.late_policy		= policy;
+	bench.camera.late_tolerance	= 1000;
+
+	long shift = 0;						// kLateShift, how far the grid has moved
+	long previous = -1;
+	while (bench.since() < 100000000L) {
+		long at = bench.since();
+		bool stall = at % 20000000L < 1000 && at > 0;
+		if (!bench.pass(stall ? 7300000 : 1000)) continue;
+
+		long off = (at - shift) % 2000000L;
+		switch (policy) {
+			case kLateSkip:
+				CHECK(off < 1000000L + 1000, "skip: frame at %ld us is %ld us off the grid", at, off);
+				break;
+
+			case kLateShift:
+				if (off >= 1000) shift += off;	// Late, the grid follows it
+				CHECK(previous < 0 || at - previous >= 2000000L, "shift: frames at %ld and %ld us", previous, at);
+				break;
+
+			default:
+				CHECK(off < 1000 || at - previous > 2000000L, "fire: frame at %ld us is %ld us off the grid", at, off);
+				break;
+		}
+		previous = at;
+	}
+
+	long slots = (bench.since() - shift - 1) / 2000000L + 1;
+	long counted = bench.camera.frame_count + (long)bench.camera.missed_frames;
+	CHECK(policy == kLateShift || counted == slots || counted == slots - 1, "policy %d: %ld frames + missed for %ld slots", policy, counted, slots);
+	CHECK(bench.camera.late_frames > 0 || policy == kLateSkip, "policy %d: no late frames counted", policy);
+	printf("late policy %d: %ld frames, %lu missed, %lu late\n", policy, bench.camera.frame_count, bench.camera.missed_frames, bench.camera.late_frames);
+}
+
+//--------------------------------------
+//	+ checkSkipKeepsClose
+//	kLateSkip drops only the slots missed by more than late_tolerance.
+//	A 4.5 s stall after the slot at 4 s misses 6 s by 2.5 s and 8 s by
+//	0.5 s, so only 6 s goes.
+void checkSkipKeepsClose()
+{
+	Bench bench(2.0f);
+	bench.camera.late_policy	= kLateSkip;
+	bench.camera.late_tolerance	= 1000;
+
+	unsigned long frames = 0;
+	long after = -1;
+	while (frames < 4) {
+		long at = bench.since();
+		bool stall = frames == 3 && after < 0;
+		if (stall) after = at + 4500000L;
+		if (!bench.pass(stall ? 4500000 : 1000)) continue;
+		frames++;
+	}
+	long at = bench.since() - 1000;
+	CHECK(bench.camera.missed_frames == 1, "%lu slots skipped, expected 1", bench.camera.missed_frames);
+	CHECK(at - after < 2000, "frame after the stall at %ld us, stall over at %ld us", at, after);
+}
+
+int main()
+{
+	checkDrift();
+	checkIntervalChange();
+	checkFocus();
+	checkManualFocus();
+	checkLate(kLateFire);
+	checkLate(kLateSkip);
+	checkLate(kLateShift);
+	checkSkipKeepsClose();
+
+	printf(failures ? "%d FAILED\n" : "ok\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,71 @@
+/*
+ *  WProgram.h
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Just enough of the Arduino core to build the timing code on a PC.
+ *	The clock is sim_us, moved on by the test; pins are plain ints.
+ *
+ *	On a 64-bit host unsigned long is 64 bits, so millis() and micros()
+ *	never wrap here. The tests cover the arithmetic, not the wraps.
+ *
+ */
+
+#ifndef WProgram_h
+#define WProgram_h
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include "avr/io.h"
+#include "avr/interrupt.h"
+#include "avr/pgmspace.h"
+
+#define HIGH	1
+#define LOW		0
+#define INPUT	0
+#define OUTPUT	1
+#define DEC		10
+#define F_CPU	16000000UL
+#define clockCyclesPerMicrosecond()	(F_CPU / 1000000L)
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+extern unsigned long	sim_us;			// The clock, microseconds
+extern int				sim_pins[32];
+extern volatile uint8_t	sim_ports[8];
+
+inline unsigned long millis() { return sim_us / 1000; }
+inline unsigned long micros() { return sim_us; }
+inline void delay(unsigned long ms) { sim_us += ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { sim_us += us; }
+
+inline void pinMode(uint8_t, uint8_t) { }
+inline void digitalWrite(uint8_t pin, uint8_t value) { sim_pins[pin] = value; }
+inline int digitalRead(uint8_t pin) { return sim_pins[pin]; }
+inline uint8_t digitalPinToPort(uint8_t pin) { return 1 + pin / 8; }
+inline uint8_t digitalPinToBitMask(uint8_t pin) { return 1 << (pin % 8); }
+inline volatile uint8_t *portOutputRegister(uint8_t port) { return &sim_ports[port]; }
+
+#define constrain(amt,low,high)	((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define min(a,b)				((a)<(b)?(a):(b))
+#define max(a,b)				((a)>(b)?(a):(b))
+#define abs(x)					((x)>0?(x):-(x))
+
+struct HardwareSerial
+{
+	void begin(long) { }
+	int available() { return 0; }
+	int read() { return -1; }
+	template <class T> void print(T) { }
+	template <class T> void print(T, int) { }
+	template <class T> void println(T) { }
+	void println() { }
+};
+template <class T> inline HardwareSerial &operator <<(HardwareSerial &s, T) { return s; }
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,11 @@
+// Host stand-in for <avr/eeprom.h>, only what the sketch uses.
+#ifndef sim_eeprom_h
+#define sim_eeprom_h
+#include <stdint.h>
+#include <string.h>
+extern uint8_t sim_eeprom[1024];
+inline uint8_t eeprom_read_byte(const uint8_t *a) { return sim_eeprom[(uintptr_t)a]; }
+inline void eeprom_write_byte(uint8_t *a, uint8_t v) { sim_eeprom[(uintptr_t)a] = v; }
+inline void eeprom_read_block(void *d, const void *a, size_t n) { memcpy(d, &sim_eeprom[(uintptr_t)a], n); }
+inline void eeprom_write_block(const void *s, void *a, size_t n) { memcpy(&sim_eeprom[(uintptr_t)a], s, n); }
+#endif
@@ -0,0 +1,8 @@
+// Host stand-in for <avr/interrupt.h>, only what the sketch uses.
+#ifndef sim_interrupt_h
+#define sim_interrupt_h
+#define ISR(vec, ...) extern "C" void vec(void)
+#define ISR_NOBLOCK
+#define sei()
+#define cli()
+#endif
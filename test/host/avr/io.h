@@ -0,0 +1,61 @@
+// Host stand-in for <avr/io.h>, only what the sketch uses.
+#ifndef sim_io_h
+#define sim_io_h
+#include <stdint.h>
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1, SREG, ADMUX, ADCSRA, ADCSRB, ADCL, ADCH, EICRA, EIMSK, EIFR, ACSR, DIDR0, DIDR1, WDTCSR, MCUSR, SMCR, PCICR, PCMSK1, TCCR2A, TCCR2B, TIMSK2, ASSR, OCR2A, TCNT2, PRR;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B, ADC, ICR1;
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define OCIE1A 1
+#define OCIE1B 2
+#define TOIE1 0
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define REFS0 6
+#define REFS1 7
+#define ADLAR 5
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define INT0 0
+#define INT1 1
+#define INTF0 0
+#define INTF1 1
+#define ACIE 3
+#define ACIS0 0
+#define ACIS1 1
+#define ACI 4
+#define ACD 7
+#define ACBG 6
+#define WDIE 6
+#define WDE 3
+#define WDCE 4
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDP3 5
+#define WDRF 3
+#define ACIC 2
+#define AIN0D 0
+#define AIN1D 1
+#define ICES1 6
+#define ICNC1 7
+#define _BV(b) (1 << (b))
+#define bit_is_set(r,b) ((r) & _BV(b))
+#define bit_is_clear(r,b) (!((r) & _BV(b)))
+#define SREG_I 7
+#endif
@@ -0,0 +1,14 @@
+// Host stand-in for <avr/pgmspace.h>, only what the sketch uses.
+#ifndef sim_pgmspace_h
+#define sim_pgmspace_h
+#include <stdint.h>
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define memcpy_P memcpy
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define strlen_P strlen
+#define strncpy_P strncpy
+#endif
@@ -0,0 +1,20 @@
+/*
+ *  core.cpp
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Storage for the host stubs: the clock, the pins and the registers.
+ *
+ */
+
+#include "WProgram.h"
+#include "avr/eeprom.h"
+
+unsigned long		sim_us = 0;
+int					sim_pins[32];
+volatile uint8_t	sim_ports[8];
+HardwareSerial		Serial;
+uint8_t				sim_eeprom[1024];
+
+volatile uint8_t	TCCR1A, TCCR1B, TIMSK1, TIFR1, SREG, ADMUX, ADCSRA, ADCSRB, ADCL, ADCH, EICRA, EIMSK, EIFR, ACSR, DIDR0, DIDR1, WDTCSR, MCUSR, SMCR, PCICR, PCMSK1, TCCR2A, TCCR2B, TIMSK2, ASSR, OCR2A, TCNT2, PRR;
+volatile uint16_t	TCNT1, OCR1A, OCR1B, ADC, ICR1;
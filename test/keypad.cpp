@@ -0,0 +1,90 @@
+/*
+ *  keypad.cpp
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Host checks for ADKeyboard's gestures: clicks, double clicks, chords
+ *	and rolls from one key to the next. Feeds it a reading a millisecond
+ *	and writes the events out as a string, "D2 U2 K2", to compare.
+ *
+ */
+
+#include "WProgram.h"
+#include "ADKeyboard.h"
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { if (!(condition)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+#define OPEN	ADKeyModule::open
+
+const unsigned int	kReadings[5]	= { ADKeyModule::r0, ADKeyModule::r1, ADKeyModule::r2, ADKeyModule::r3, ADKeyModule::r4 };
+const char			kTypes[]		= "DURLXCK";	// By eKeyEventType
+
+ADKeyboard<ADKeyModule>	*keypad;
+char					events[128];
+
+// Holds a reading for msecs, a sample a millisecond, and writes out what comes of it
+void hold(unsigned int reading, unsigned long msecs)
+{
+	for (unsigned long ms = 0; ms < msecs; ms++) {
+		keypad->sample(reading);
+		sim_us += 1000;
+
+		KeyEvent event;
+		while (keypad->nextEvent(&event)) {
+			char *end = events + strlen(events);
+			if (event.type == kKeyChord) sprintf(end, "%s%c%d/%d", *events ? " " : "", kTypes[event.type], event.key, event.other);
+			else sprintf(end, "%s%c%d", *events ? " " : "", kTypes[event.type], event.key);
+		}
+	}
+}
+
+void press(int key, unsigned long msecs) { hold(kReadings[key], msecs); }
+
+void begin()
+{
+	delete keypad;
+	keypad = new ADKeyboard<ADKeyModule>(0);
+	keypad->setDoubleClickKeys((1 << 2) | (1 << 3));	// As the sketch has it, next and previous
+	events[0] = '\0';
+	hold(OPEN, 10);
+}
+
+void expect(const char *what, const char *wanted)
+{
+	hold(OPEN, 1000);						// Let any click still waiting come out
+	CHECK(!strcmp(events, wanted), "%s: got \"%s\", expected \"%s\"", what, events, wanted);
+}
+
+int main()
+{
+	sim_us = 1000000;
+
+	begin();
+	press(0, 100); hold(OPEN, 100); press(0, 100);
+	expect("enter twice", "D0 U0 K0 D0 U0 K0");
+
+	begin();
+	press(2, 100); hold(OPEN, 100); press(2, 100);
+	expect("next twice", "D2 U2 D2 X2 U2");
+
+	begin();
+	press(2, 100);
+	expect("next once", "D2 U2 K2");
+
+	begin();
+	press(2, 100); press(0, 200); press(2, 100);
+	expect("chord, second key let go first", "D2 C0/2 U0 U2");
+
+	begin();
+	press(2, 100); press(0, 200);
+	expect("chord, first key let go first", "D2 C0/2 U0 U2");
+
+	begin();
+	press(3, 400); press(1, 100);
+	expect("roll to a lower key", "D3 U3 K3 D1 U1 K1");
+
+	printf(failures ? "%d FAILED\n" : "ok\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+/*
+ *  scheduler.cpp
+ *  Peter Hinson / 2011
+ *	mewp.net
+ *
+ *  Host checks for Scheduler: tasks moved or cancelled from another
+ *	task's callback while they're still waiting to run in the same pass.
+ *
+ */
+
+#include "WProgram.h"
+#include "Scheduler.h"
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { if (!(condition)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+Scheduler	*scheduler;
+Task		first, second, third;
+int			runs[3];
+
+// first re-arms or cancels second, which run() has already taken off its list with it
+bool		rearm;
+void runFirst() { runs[0]++; if (rearm) scheduler->at(&second, Timebase::now()); else scheduler->cancel(&second); }
+void runSecond() { runs[1]++; }
+void runThird() { runs[2]++; }
+
+// Queues all three for the same tick, runs a few passes and checks each ran as many times as expected
+void check(bool with_rearm, unsigned long due, int second_runs)
+{
+	scheduler	= new Scheduler;
+	rearm		= with_rearm;
+	runs[0] = runs[1] = runs[2] = 0;
+
+	scheduler->add(&third, runThird);
+	scheduler->add(&second, runSecond);
+	scheduler->add(&first, runFirst);
+	scheduler->at(&third, Timebase::now() + due);
+	scheduler->at(&second, Timebase::now() + due);
+	scheduler->at(&first, Timebase::now() + due);	// Last in, so it's first in its list
+
+	for (int pass = 0; pass < 10; pass++) {
+		sim_us += 1000;
+		scheduler->run();
+	}
+	const char *how = with_rearm ? "re-armed" : "cancelled";
+	CHECK(runs[0] == 1, "%s, due in %lu ms: first ran %d times", how, due, runs[0]);
+	CHECK(runs[1] == second_runs, "%s, due in %lu ms: second ran %d times, expected %d", how, due, runs[1], second_runs);
+	CHECK(runs[2] == 1, "%s, due in %lu ms: third ran %d times", how, due, runs[2]);
+	CHECK(scheduler->untilNext() == 0xFFFFFFFFUL, "%s, due in %lu ms: tasks left queued", how, due);
+	delete scheduler;
+}
+
+int main()
+{
+	sim_us = 1000000;
+	check(true, 0, 1);					// From the ready list
+	check(true, 3, 1);					// From a slot of the wheel
+	check(false, 0, 0);
+	check(false, 3, 0);
+
+	printf(failures ? "%d FAILED\n" : "ok\n", failures);
+	return failures ? 1 : 0;
+}